@@ -0,0 +1,632 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file blockhash.cpp
+ *
+ * @brief Per-block SHA-256 hashes of local and remote files
+ *
+ * @see blockhash.h
+ */
+
+#include "blockhash.h"
+#include "common.h"
+
+#define BLOCKHASH_RUN_LEN 1024 * 1024 * 4
+
+/**
+ * @brief State shared by the hashing threads
+ *
+ * Threads claim runs of whole blocks, so each read is large even when blocks are small.
+ */
+struct blockhash_ctx {
+   int fd;                         ///< Local file descriptor, or -1 to read from the volume
+   struct UG_state* ug;            ///< The UG state (remote files)
+   char const* path;               ///< Path to the file in the volume (remote files)
+   uint64_t size;                  ///< Bytes to hash
+   uint64_t block_size;            ///< Size of each block
+   uint64_t run_blocks;            ///< Blocks per claim
+   uint64_t num_blocks;            ///< Number of blocks
+   unsigned char* hashes;          ///< Digests, in block order
+   uint64_t next_block;            ///< Next block to claim
+   int rc;                         ///< 0, or the first error
+   pthread_mutex_t lock;           ///< Guards next_block and rc
+};
+
+
+// number of blocks in a file
+uint64_t blockhash_count( uint64_t size, uint64_t block_size ) {
+   return (size + block_size - 1) / block_size;
+}
+
+
+/**
+ * @brief Read len bytes at offset from a local file or a UG handle
+ *
+ * @retval 0 Success
+ * @retval -ENODATA EOF came first
+ * @retval -errno Failure
+ */
+static int blockhash_read( struct blockhash_ctx* ctx, UG_handle_t* fh, char* buf, uint64_t len, uint64_t offset ) {
+
+   ssize_t nr = 0;
+   uint64_t total = 0;
+   off_t pos = 0;
+
+   if( fh != NULL ) {
+
+      pos = UG_seek( fh, offset, SEEK_SET );
+      if( pos < 0 || (uint64_t)pos != offset ) {
+         return (pos < 0 ? (int)pos : -EIO);
+      }
+   }
+
+   while( total < len ) {
+
+      if( fh != NULL ) {
+         nr = UG_read( ctx->ug, buf + total, len - total, fh );
+      }
+      else {
+
+         nr = pread( ctx->fd, buf + total, len - total, offset + total );
+         if( nr < 0 ) {
+
+            if( errno == EINTR ) {
+               continue;
+            }
+
+            nr = -errno;
+         }
+      }
+
+      if( nr < 0 ) {
+         return (int)nr;
+      }
+      if( nr == 0 ) {
+         return -ENODATA;
+      }
+
+      total += nr;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Hashing thread: claim runs of blocks, read each run, and hash its blocks
+ *
+ * @param[in] arg The blockhash_ctx
+ * @return NULL
+ */
+static void* blockhash_worker( void* arg ) {
+
+   struct blockhash_ctx* ctx = (struct blockhash_ctx*)arg;
+   UG_handle_t* fh = NULL;
+   char* buf = NULL;
+   uint64_t first = 0;
+   uint64_t count = 0;
+   uint64_t offset = 0;
+   uint64_t len = 0;
+   uint64_t block_len = 0;
+   int rc = 0;
+
+   buf = SG_CALLOC( char, ctx->run_blocks * ctx->block_size );
+   if( buf == NULL ) {
+      rc = -ENOMEM;
+      goto blockhash_worker_end;
+   }
+
+   if( ctx->fd < 0 ) {
+
+      fh = UG_open( ctx->ug, ctx->path, O_RDONLY, &rc );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to open '%s': %d %s\n", ctx->path, rc, strerror( abs(rc) ) );
+         fh = NULL;
+         goto blockhash_worker_end;
+      }
+   }
+
+   while( 1 ) {
+
+      // claim the next run
+      pthread_mutex_lock( &ctx->lock );
+
+      if( ctx->rc != 0 || ctx->next_block >= ctx->num_blocks ) {
+         pthread_mutex_unlock( &ctx->lock );
+         break;
+      }
+
+      first = ctx->next_block;
+      count = std::min( ctx->run_blocks, ctx->num_blocks - first );
+      ctx->next_block += count;
+
+      pthread_mutex_unlock( &ctx->lock );
+
+      offset = first * ctx->block_size;
+      len = std::min( count * ctx->block_size, ctx->size - offset );
+
+      rc = blockhash_read( ctx, fh, buf, len, offset );
+      if( rc != 0 ) {
+         break;
+      }
+
+      for( uint64_t i = 0; i < count; i++ ) {
+
+         block_len = std::min( ctx->block_size, len - i * ctx->block_size );
+
+         if( EVP_Digest( buf + i * ctx->block_size, block_len, ctx->hashes + (first + i) * BLOCKHASH_LEN, NULL, EVP_sha256(), NULL ) != 1 ) {
+            rc = -EIO;
+            break;
+         }
+      }
+
+      if( rc != 0 ) {
+         break;
+      }
+   }
+
+blockhash_worker_end:
+
+   if( fh != NULL ) {
+      UG_close( ctx->ug, fh );
+   }
+
+   SG_safe_free( buf );
+
+   if( rc != 0 ) {
+
+      pthread_mutex_lock( &ctx->lock );
+      if( ctx->rc == 0 ) {
+         ctx->rc = rc;
+      }
+      pthread_mutex_unlock( &ctx->lock );
+   }
+
+   return NULL;
+}
+
+
+/**
+ * @brief Hash all blocks of a local or remote file with a pool of threads
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int blockhash_run( struct blockhash_ctx* ctx, int num_threads ) {
+
+   int rc = 0;
+   pthread_t* threads = NULL;
+
+   ctx->num_blocks = blockhash_count( ctx->size, ctx->block_size );
+   ctx->run_blocks = std::max( (uint64_t)(BLOCKHASH_RUN_LEN) / ctx->block_size, (uint64_t)1 );
+   ctx->next_block = 0;
+   ctx->rc = 0;
+
+   if( ctx->num_blocks == 0 ) {
+      return 0;
+   }
+
+   num_threads = (int)std::min( (uint64_t)std::max( num_threads, 1 ), (ctx->num_blocks + ctx->run_blocks - 1) / ctx->run_blocks );
+
+   threads = SG_CALLOC( pthread_t, num_threads );
+   if( threads == NULL ) {
+      return -ENOMEM;
+   }
+
+   pthread_mutex_init( &ctx->lock, NULL );
+
+   rc = start_threads( threads, num_threads, blockhash_worker, ctx );
+   if( rc < 0 ) {
+      fprintf(stderr, "Failed to start hash threads: %s\n", strerror(-rc));
+   }
+   else {
+      join_threads( threads, rc );
+      rc = ctx->rc;
+   }
+
+   pthread_mutex_destroy( &ctx->lock );
+   SG_safe_free( threads );
+
+   return rc;
+}
+
+
+// hash a local file's blocks
+int blockhash_local( int fd, uint64_t size, uint64_t block_size, int num_threads, unsigned char* hashes ) {
+
+   struct blockhash_ctx ctx;
+
+   memset( &ctx, 0, sizeof(struct blockhash_ctx) );
+
+   ctx.fd = fd;
+   ctx.size = size;
+   ctx.block_size = block_size;
+   ctx.hashes = hashes;
+
+   return blockhash_run( &ctx, num_threads );
+}
+
+
+// hash a remote file's blocks
+int blockhash_remote( struct UG_state* ug, char const* path, uint64_t size, uint64_t block_size, int num_threads, unsigned char* hashes ) {
+
+   struct blockhash_ctx ctx;
+
+   memset( &ctx, 0, sizeof(struct blockhash_ctx) );
+
+   ctx.fd = -1;
+   ctx.ug = ug;
+   ctx.path = path;
+   ctx.size = size;
+   ctx.block_size = block_size;
+   ctx.hashes = hashes;
+
+   return blockhash_run( &ctx, num_threads );
+}
+
+
+// identify the contents of a remote file
+char* blockhash_header( struct md_entry* ent, uint64_t block_size ) {
+
+   char* header = SG_CALLOC( char, BLOCKHASH_HEADER_MAX );
+
+   if( header != NULL ) {
+      snprintf( header, BLOCKHASH_HEADER_MAX, "syndicate-blockhash %" PRIX64 " %" PRId64 " %" PRId64 " %jd %" PRIu64,
+                ent->file_id, ent->version, ent->write_nonce, (intmax_t)ent->size, block_size );
+   }
+
+   return header;
+}
+
+
+/**
+ * @brief Parse one hex digit
+ *
+ * @return The digit's value, or -1 if it is not a hex digit
+ */
+static int blockhash_hex_digit( char c ) {
+
+   if( c >= '0' && c <= '9' ) {
+      return c - '0';
+   }
+   if( c >= 'a' && c <= 'f' ) {
+      return c - 'a' + 10;
+   }
+
+   return -1;
+}
+
+
+/**
+ * @brief Serialize block hashes: the header line, then one hex digest per line
+ *
+ * @param[out] len Length of the text
+ * @return The text (to be freed), or NULL if out of memory
+ */
+static char* blockhash_format( char const* header, uint64_t num_blocks, unsigned char const* hashes, size_t* len ) {
+
+   size_t header_len = strlen(header);
+   char* buf = NULL;
+   char* p = NULL;
+
+   *len = header_len + 1 + num_blocks * (2 * BLOCKHASH_LEN + 1);
+
+   buf = SG_CALLOC( char, *len + 1 );
+   if( buf == NULL ) {
+      return NULL;
+   }
+
+   memcpy( buf, header, header_len );
+   buf[header_len] = '\n';
+   p = buf + header_len + 1;
+
+   for( uint64_t b = 0; b < num_blocks; b++ ) {
+
+      for( int i = 0; i < BLOCKHASH_LEN; i++ ) {
+         sprintf( p, "%02x", hashes[ b * BLOCKHASH_LEN + i ] );
+         p += 2;
+      }
+
+      *p = '\n';
+      p++;
+   }
+
+   return buf;
+}
+
+
+/**
+ * @brief Parse serialized block hashes
+ *
+ * @retval 0 Success
+ * @retval -ENOENT The text is of something else, or is malformed
+ */
+static int blockhash_parse( char const* buf, size_t len, char const* header, uint64_t num_blocks, unsigned char* hashes ) {
+
+   size_t header_len = strlen(header);
+   char const* p = NULL;
+   int hi = 0;
+   int lo = 0;
+
+   if( len != header_len + 1 + num_blocks * (2 * BLOCKHASH_LEN + 1) || strncmp( buf, header, header_len ) != 0 || buf[header_len] != '\n' ) {
+      return -ENOENT;
+   }
+
+   p = buf + header_len + 1;
+
+   for( uint64_t b = 0; b < num_blocks; b++ ) {
+
+      for( int i = 0; i < BLOCKHASH_LEN; i++ ) {
+
+         hi = blockhash_hex_digit( p[2*i] );
+         lo = blockhash_hex_digit( p[2*i+1] );
+         if( hi < 0 || lo < 0 ) {
+            return -ENOENT;
+         }
+
+         hashes[ b * BLOCKHASH_LEN + i ] = (unsigned char)((hi << 4) | lo);
+      }
+
+      if( p[2 * BLOCKHASH_LEN] != '\n' ) {
+         return -ENOENT;
+      }
+
+      p += 2 * BLOCKHASH_LEN + 1;
+   }
+
+   return 0;
+}
+
+
+// load cached hashes
+int blockhash_cache_load( char const* cache_path, char const* header, uint64_t num_blocks, unsigned char* hashes ) {
+
+   int rc = 0;
+   int fd = -1;
+   struct stat sb;
+   char* buf = NULL;
+   ssize_t nr = 0;
+   size_t total = 0;
+
+   fd = open( cache_path, O_RDONLY );
+   if( fd < 0 ) {
+      return (errno == ENOENT ? -ENOENT : -errno);
+   }
+
+   if( fstat( fd, &sb ) != 0 ) {
+      rc = -errno;
+      close( fd );
+      return rc;
+   }
+
+   buf = SG_CALLOC( char, sb.st_size + 1 );
+   if( buf == NULL ) {
+      close( fd );
+      return -ENOMEM;
+   }
+
+   while( total < (size_t)sb.st_size ) {
+
+      nr = read( fd, buf + total, sb.st_size - total );
+      if( nr < 0 && errno == EINTR ) {
+         continue;
+      }
+      if( nr <= 0 ) {
+         break;
+      }
+
+      total += nr;
+   }
+
+   close( fd );
+
+   rc = blockhash_parse( buf, total, header, num_blocks, hashes );
+   if( rc != 0 ) {
+      SG_debug("Block hash cache '%s' is stale\n", cache_path );
+   }
+
+   SG_safe_free( buf );
+   return rc;
+}
+
+
+// store hashes, replacing the cache atomically
+int blockhash_cache_store( char const* cache_path, char const* header, uint64_t num_blocks, unsigned char const* hashes ) {
+
+   int rc = 0;
+   int fd = -1;
+   char* tmp_path = NULL;
+   char* buf = NULL;
+   size_t len = 0;
+   size_t total = 0;
+   ssize_t nw = 0;
+
+   tmp_path = SG_CALLOC( char, strlen(cache_path) + 5 );
+   buf = blockhash_format( header, num_blocks, hashes, &len );
+   if( tmp_path == NULL || buf == NULL ) {
+      SG_safe_free( tmp_path );
+      SG_safe_free( buf );
+      return -ENOMEM;
+   }
+
+   sprintf( tmp_path, "%s.tmp", cache_path );
+
+   fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+   if( fd < 0 ) {
+      rc = -errno;
+      SG_safe_free( tmp_path );
+      SG_safe_free( buf );
+      return rc;
+   }
+
+   while( total < len ) {
+
+      nw = write( fd, buf + total, len - total );
+      if( nw < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         rc = -errno;
+         break;
+      }
+
+      total += nw;
+   }
+
+   if( rc == 0 && fsync( fd ) != 0 ) {
+      rc = -errno;
+   }
+
+   if( close( fd ) != 0 && rc == 0 ) {
+      rc = -errno;
+   }
+
+   if( rc == 0 && rename( tmp_path, cache_path ) != 0 ) {
+      rc = -errno;
+   }
+
+   if( rc != 0 ) {
+      unlink( tmp_path );
+   }
+
+   SG_safe_free( tmp_path );
+   SG_safe_free( buf );
+   return rc;
+}
+
+
+/**
+ * @brief Load the hashes stored in one of a remote file's xattrs
+ *
+ * @retval 0 Success
+ * @retval -ENOENT There is no such xattr, or its hashes are stale
+ * @retval -errno Failure
+ */
+static int blockhash_getxattr( struct UG_state* ug, char const* path, char const* name, char const* header, uint64_t num_blocks, unsigned char* hashes ) {
+
+   int rc = 0;
+   char* buf = NULL;
+   ssize_t len = 0;
+   ssize_t len2 = 0;
+
+   len = UG_getxattr( ug, path, name, NULL, 0 );
+   if( len < 0 ) {
+      return (len == -ENODATA ? -ENOENT : (int)len);
+   }
+
+   buf = SG_CALLOC( char, len + 1 );
+   if( buf == NULL ) {
+      return -ENOMEM;
+   }
+
+   len2 = UG_getxattr( ug, path, name, buf, len );
+   if( len2 < 0 ) {
+      SG_safe_free( buf );
+      return (int)len2;
+   }
+
+   rc = blockhash_parse( buf, std::min( len, len2 ), header, num_blocks, hashes );
+   if( rc != 0 ) {
+      SG_debug("Hashes in '%s' on '%s' are stale\n", name, path );
+   }
+
+   SG_safe_free( buf );
+   return rc;
+}
+
+
+/**
+ * @brief Store hashes in one of a remote file's xattrs
+ *
+ * @retval 0 Success
+ * @retval -E2BIG Too many hashes to fit into BLOCKHASH_XATTR_MAX bytes
+ * @retval -errno Failure
+ */
+static int blockhash_setxattr( struct UG_state* ug, char const* path, char const* name, char const* header, uint64_t num_blocks, unsigned char const* hashes ) {
+
+   int rc = 0;
+   char* buf = NULL;
+   size_t len = 0;
+
+   buf = blockhash_format( header, num_blocks, hashes, &len );
+   if( buf == NULL ) {
+      return -ENOMEM;
+   }
+
+   if( len > BLOCKHASH_XATTR_MAX ) {
+
+      SG_debug("Too many blocks in '%s' to publish their hashes (%" PRIu64 ")\n", path, num_blocks );
+      SG_safe_free( buf );
+      return -E2BIG;
+   }
+
+   rc = UG_setxattr( ug, path, name, buf, len, 0 );
+   if( rc < 0 ) {
+      fprintf(stderr, "Failed to setxattr '%s' '%s': %s\n", path, name, strerror(abs(rc)) );
+   }
+
+   SG_safe_free( buf );
+   return rc;
+}
+
+
+// load the hashes published on a remote file
+int blockhash_xattr_load( struct UG_state* ug, char const* path, char const* header, uint64_t num_blocks, unsigned char* hashes ) {
+   return blockhash_getxattr( ug, path, BLOCKHASH_XATTR, header, num_blocks, hashes );
+}
+
+
+// publish hashes on a remote file
+int blockhash_xattr_store( struct UG_state* ug, char const* path, char const* header, uint64_t num_blocks, unsigned char const* hashes ) {
+   return blockhash_setxattr( ug, path, BLOCKHASH_XATTR, header, num_blocks, hashes );
+}
+
+
+// digest a whole local file: the SHA-256 of its block hashes
+int blockhash_digest_local( int fd, uint64_t size, int num_threads, unsigned char* digest ) {
+
+   int rc = 0;
+   uint64_t num_blocks = blockhash_count( size, BLOCKHASH_DIGEST_BLOCK_SIZE );
+   unsigned char* hashes = NULL;
+
+   hashes = SG_CALLOC( unsigned char, num_blocks * BLOCKHASH_LEN + 1 );
+   if( hashes == NULL ) {
+      return -ENOMEM;
+   }
+
+   rc = blockhash_local( fd, size, BLOCKHASH_DIGEST_BLOCK_SIZE, num_threads, hashes );
+   if( rc == 0 && EVP_Digest( hashes, num_blocks * BLOCKHASH_LEN, digest, NULL, EVP_sha256(), NULL ) != 1 ) {
+      rc = -EIO;
+   }
+
+   SG_safe_free( hashes );
+   return rc;
+}
+
+
+// load the digest published on a remote file
+int blockhash_digest_xattr_load( struct UG_state* ug, char const* path, char const* header, unsigned char* digest ) {
+   return blockhash_getxattr( ug, path, BLOCKHASH_DIGEST_XATTR, header, 1, digest );
+}
+
+
+// publish a digest on a remote file
+int blockhash_digest_xattr_store( struct UG_state* ug, char const* path, char const* header, unsigned char const* digest ) {
+   return blockhash_setxattr( ug, path, BLOCKHASH_DIGEST_XATTR, header, 1, digest );
+}
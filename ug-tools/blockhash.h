@@ -0,0 +1,199 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file blockhash.h
+ *
+ * @brief Per-block SHA-256 hashes of local and remote files
+ *
+ * A file is hashed in fixed-size blocks (normally the volume block size), so
+ * two copies of a file can be compared block by block without moving the
+ * blocks that match.  Hashing is spread over a pool of threads, each of
+ * which reads runs of blocks on its own.  The digests are computed by
+ * OpenSSL, which uses the CPU's SHA extensions or vector units where it can.
+ *
+ * A whole file's digest is the SHA-256 of the hashes of its 4M blocks, so it
+ * can be computed on many threads at once, and does not depend on the I/O unit.
+ *
+ * Hashes can be cached in a local file, or published on the remote file as an
+ * xattr.  Either way they are stored as text: a line that identifies what was
+ * hashed, followed by one hex digest per line.
+ *
+ * @see blockhash.cpp
+ */
+
+#ifndef _SYNDICATE_BLOCKHASH_H_
+#define _SYNDICATE_BLOCKHASH_H_
+
+#include <libsyndicate-ug/client.h>
+#include <libsyndicate-ug/core.h>
+
+#include <pthread.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#define BLOCKHASH_LEN SHA256_DIGEST_LENGTH
+#define BLOCKHASH_HEADER_MAX 128
+#define BLOCKHASH_XATTR "user.syndicate.blockhash"
+#define BLOCKHASH_XATTR_MAX 1024 * 1024
+#define BLOCKHASH_DIGEST_XATTR "user.syndicate.digest"
+#define BLOCKHASH_DIGEST_BLOCK_SIZE 1024 * 1024 * 4
+
+/**
+ * @brief Get the number of blocks in a file
+ *
+ * @param[in] size Size of the file
+ * @param[in] block_size Size of each block (the last one may be shorter)
+ * @return The number of blocks
+ */
+uint64_t blockhash_count( uint64_t size, uint64_t block_size );
+
+/**
+ * @brief Hash each block of a local file
+ *
+ * @param[in] fd Local file descriptor, read with pread
+ * @param[in] size Number of bytes to hash, from offset 0
+ * @param[in] block_size Size of each block
+ * @param[in] num_threads Number of threads to hash with
+ * @param[out] hashes Room for blockhash_count( size, block_size ) digests of BLOCKHASH_LEN bytes each
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+int blockhash_local( int fd, uint64_t size, uint64_t block_size, int num_threads, unsigned char* hashes );
+
+/**
+ * @brief Hash each block of a file in the volume, each thread reading through a handle of its own
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] size Number of bytes to hash, from offset 0
+ * @param[in] block_size Size of each block
+ * @param[in] num_threads Number of threads to hash with
+ * @param[out] hashes Room for blockhash_count( size, block_size ) digests of BLOCKHASH_LEN bytes each
+ * @retval 0 Success
+ * @retval -ENODATA The file is shorter than size
+ * @retval -errno Failure
+ */
+int blockhash_remote( struct UG_state* ug, char const* path, uint64_t size, uint64_t block_size, int num_threads, unsigned char* hashes );
+
+/**
+ * @brief Build the line that identifies which contents of a remote file a set of block hashes describes
+ *
+ * The line changes whenever the file is written, truncated or replaced.
+ *
+ * @param[in] ent The remote file's metadata
+ * @param[in] block_size Size of each block
+ * @return The line (to be freed), or NULL if out of memory
+ */
+char* blockhash_header( struct md_entry* ent, uint64_t block_size );
+
+/**
+ * @brief Load cached block hashes
+ *
+ * @param[in] cache_path Path to the cache file
+ * @param[in] header One line (without a newline) identifying what the hashes must be of
+ * @param[in] num_blocks Number of hashes to load
+ * @param[out] hashes Room for num_blocks digests
+ * @retval 0 Success
+ * @retval -ENOENT There is no cache, or it is of something else
+ * @retval -errno Failure
+ */
+int blockhash_cache_load( char const* cache_path, char const* header, uint64_t num_blocks, unsigned char* hashes );
+
+/**
+ * @brief Store block hashes in a cache file, replacing it atomically
+ *
+ * Nothing is printed on failure; the caller decides whether it matters.
+ *
+ * @param[in] cache_path Path to the cache file
+ * @param[in] header One line (without a newline) identifying what the hashes are of
+ * @param[in] num_blocks Number of hashes
+ * @param[in] hashes The digests
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+int blockhash_cache_store( char const* cache_path, char const* header, uint64_t num_blocks, unsigned char const* hashes );
+
+/**
+ * @brief Load the block hashes published on a remote file
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] header The line the hashes must have been published with
+ * @param[in] num_blocks Number of hashes to load
+ * @param[out] hashes Room for num_blocks digests
+ * @retval 0 Success
+ * @retval -ENOENT There are no hashes, or they are of an older version of the file
+ * @retval -errno Failure
+ */
+int blockhash_xattr_load( struct UG_state* ug, char const* path, char const* header, uint64_t num_blocks, unsigned char* hashes );
+
+/**
+ * @brief Publish block hashes on a remote file, so others can compare against it without reading it
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] header One line (without a newline) identifying what the hashes are of
+ * @param[in] num_blocks Number of hashes
+ * @param[in] hashes The digests
+ * @retval 0 Success
+ * @retval -E2BIG Too many blocks to fit into BLOCKHASH_XATTR_MAX bytes
+ * @retval -errno Failure
+ */
+int blockhash_xattr_store( struct UG_state* ug, char const* path, char const* header, uint64_t num_blocks, unsigned char const* hashes );
+
+/**
+ * @brief Compute the digest of a whole local file, hashing its blocks in parallel
+ *
+ * The digest is the SHA-256 of the concatenated SHA-256 hashes of the file's
+ * BLOCKHASH_DIGEST_BLOCK_SIZE-byte blocks.
+ *
+ * @param[in] fd Local file descriptor, read with pread
+ * @param[in] size Size of the file
+ * @param[in] num_threads Number of threads to hash with
+ * @param[out] digest Room for BLOCKHASH_LEN bytes
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+int blockhash_digest_local( int fd, uint64_t size, int num_threads, unsigned char* digest );
+
+/**
+ * @brief Load the digest published on a remote file
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] header The line the digest must have been published with
+ * @param[out] digest Room for BLOCKHASH_LEN bytes
+ * @retval 0 Success
+ * @retval -ENOENT There is no digest, or it is of an older version of the file
+ * @retval -errno Failure
+ */
+int blockhash_digest_xattr_load( struct UG_state* ug, char const* path, char const* header, unsigned char* digest );
+
+/**
+ * @brief Publish a digest of a remote file's contents on it
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] header One line (without a newline) identifying what the digest is of
+ * @param[in] digest The digest
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+int blockhash_digest_xattr_store( struct UG_state* ug, char const* path, char const* header, unsigned char const* digest );
+
+#endif
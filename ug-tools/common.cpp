@@ -65,19 +65,111 @@ static int shift_args( int argc, char** argv, int index ) {
    return argc - 1;
 }
 
+
+/**
+ * @brief remove a consumed option, and its separate argument if it has one, from argv
+ *
+ * getopt_long permutes its copy of argv, so the option is found by pointer rather than by index.
+ *
+ * @param argc Arg count
+ * @param argv Arg string
+ * @param opt The option string to remove
+ * @param arg The option's argument, or NULL if it has none
+ *
+ * @return the new argc
+ */
+static int consume_arg( int argc, char** argv, char* opt, char* arg ) {
+
+   for( int i = 0; i < argc; i++ ) {
+
+      if( argv[i] != opt ) {
+         continue;
+      }
+
+      argc = shift_args( argc, argv, i );
+
+      // separate argument follows the option
+      if( arg != NULL && i < argc && argv[i] == arg ) {
+         argc = shift_args( argc, argv, i );
+      }
+
+      break;
+   }
+
+   return argc;
+}
+
+/**
+ * @brief Get the TOOL_OPT_* flag a tool needs to accept an option
+ *
+ * @param c The option's code from getopt_long
+ * @return The flag, or 0 if every tool accepts the option
+ */
+static int tool_opt_flag( int c ) {
+
+   switch( c ) {
+      case 'j': return TOOL_OPT_JOBS;
+      case 'b': return TOOL_OPT_BUFFER;
+      case 'D': return TOOL_OPT_DEPTH;
+      case 'R': return TOOL_OPT_REREAD;
+      case 'M': return TOOL_OPT_MMAP;
+      case 'I': return TOOL_OPT_IO_SIZE;
+      case 'V': return TOOL_OPT_VECTORED;
+      case 'G': return TOOL_OPT_VECTORED;
+      case 'O': return TOOL_OPT_OUTPUT;
+      case 'A': return TOOL_OPT_READAHEAD;
+      case 'J': return TOOL_OPT_RESUME;
+      case 'C': return TOOL_OPT_CHECKPOINT;
+      case 'X': return TOOL_OPT_DELTA;
+      case 'U': return TOOL_OPT_UPDATE;
+      case 'S': return TOOL_OPT_SPARSE;
+      case 'Z': return TOOL_OPT_DETECT_ZEROS;
+      case 'r': return TOOL_OPT_RECURSIVE;
+      case 'F': return TOOL_OPT_GROUP_COMMIT;
+      case 'K': return TOOL_OPT_SKIP_UNCHANGED;
+      default:  return 0;
+   }
+}
+
+
 // parse args for common tool options
-// consume options that apply to the tool
+// consume options that apply to the tool, and reject tool options it doesn't support
 // return the new argc
-int parse_args( int argc, char** argv, struct tool_opts* opts ) {
+int parse_args( int argc, char** argv, struct tool_opts* opts, int supported ) {
     
    static struct option tool_options[] = {
-      {"benchmark",       no_argument,   0, 'B'},
+      {"benchmark",       no_argument,         0, 'B'},
+      {"jobs",            required_argument,   0, 'j'},
+      {"parallel",        required_argument,   0, 'j'},
+      {"buffer",          required_argument,   0, 'b'},
+      {"depth",           required_argument,   0, 'D'},
+      {"reread",          no_argument,         0, 'R'},
+      {"mmap",            no_argument,         0, 'M'},
+      {"io-size",         required_argument,   0, 'I'},
+      {"vectored",        no_argument,         0, 'V'},
+      {"gap",             required_argument,   0, 'G'},
+      {"output",          required_argument,   0, 'O'},
+      {"readahead",       required_argument,   0, 'A'},
+      {"resume",          no_argument,         0, 'J'},
+      {"checkpoint",      required_argument,   0, 'C'},
+      {"delta",           no_argument,         0, 'X'},
+      {"update",          no_argument,         0, 'U'},
+      {"sparse",          no_argument,         0, 'S'},
+      {"detect-zeros",    no_argument,         0, 'Z'},
+      {"recursive",       no_argument,         0, 'r'},
+      {"group-commit",    no_argument,         0, 'F'},
+      {"skip-unchanged",  no_argument,         0, 'K'},
       {0, 0, 0, 0}
    };
 
-   char const* optstr = "B";
+   char optstr[8] = "B";
    int c = 0;
+   int flag = 0;
    int opt_index = 0;
+   int rc = 0;
+   int argc_dup = argc;
+   char* opt = NULL;
+   char* tmp = NULL;
    
    // duplicate argv, since getopt_long reorders it
    char** argv_dup = SG_CALLOC( char*, argc + 1 );
@@ -89,20 +181,189 @@ int parse_args( int argc, char** argv, struct tool_opts* opts ) {
        argv_dup[i] = argv[i];
    }
    
+   // only claim the short options the tool uses
+   if( supported & TOOL_OPT_JOBS ) {
+       strcat( optstr, "j:" );
+   }
+   if( supported & TOOL_OPT_RECURSIVE ) {
+       strcat( optstr, "r" );
+   }
+
    opterr = 0;
    
    while( c != -1 ) {
        
-       c = getopt_long( argc, argv_dup, optstr, tool_options, &opt_index );
+       c = getopt_long( argc_dup, argv_dup, optstr, tool_options, &opt_index );
        if( c < 0 ) {
            break;
        }
        
+       // the option string itself (its argument may be separate from it)
+       if( optarg != NULL && optind >= 2 && argv_dup[optind-1] == optarg ) {
+           opt = argv_dup[optind-2];
+       }
+       else {
+           opt = argv_dup[optind-1];
+       }
+
+       flag = tool_opt_flag( c );
+       if( flag != 0 && (supported & flag) == 0 ) {
+
+           fprintf(stderr, "Unsupported option '%s'\n", opt );
+           rc = -EINVAL;
+           argc = consume_arg( argc, argv, opt, optarg );
+           continue;
+       }
+
        switch( c ) {
            
            case 'B': {
                opts->benchmark = true;
-               argc = shift_args( argc, argv, optind - 1 );
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'j': {
+               opts->jobs = (int)strtol( optarg, &tmp, 10 );
+               if( *tmp != '\0' || opts->jobs <= 0 ) {
+                   fprintf(stderr, "Invalid job count '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'b': {
+               if( parse_size( optarg, &opts->buffer_size ) != 0 || opts->buffer_size == 0 ) {
+                   fprintf(stderr, "Invalid buffer size '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'D': {
+               opts->depth = (int)strtol( optarg, &tmp, 10 );
+               if( *tmp != '\0' || opts->depth < 2 ) {
+                   fprintf(stderr, "Invalid pipeline depth '%s' (need at least 2)\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'R': {
+               opts->reread = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'M': {
+               opts->mmap = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'I': {
+               if( parse_size( optarg, &opts->io_size ) != 0 || opts->io_size == 0 ) {
+                   fprintf(stderr, "Invalid I/O size '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'O': {
+               opts->output = optarg;
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'J': {
+               opts->resume = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'r': {
+               opts->recursive = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'F': {
+               opts->group_commit = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'K': {
+               opts->skip_unchanged = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'S': {
+               opts->sparse = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'Z': {
+               opts->detect_zeros = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'U': {
+               opts->update = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'X': {
+               opts->delta = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'C': {
+               if( parse_size( optarg, &opts->checkpoint ) != 0 || opts->checkpoint == 0 ) {
+                   fprintf(stderr, "Invalid checkpoint size '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'A': {
+               if( parse_size( optarg, &opts->readahead ) != 0 ) {
+                   fprintf(stderr, "Invalid readahead size '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
+               break;
+           }
+
+           case 'V': {
+               opts->vectored = true;
+               argc = consume_arg( argc, argv, opt, NULL );
+               break;
+           }
+
+           case 'G': {
+               if( parse_size( optarg, &opts->gap ) != 0 ) {
+                   fprintf(stderr, "Invalid gap '%s'\n", optarg );
+                   rc = -EINVAL;
+               }
+
+               argc = consume_arg( argc, argv, opt, optarg );
                break;
            }
 
@@ -118,9 +379,162 @@ int parse_args( int argc, char** argv, struct tool_opts* opts ) {
    optind = 0;
    opterr = 0;
    
+   if( rc != 0 ) {
+       return rc;
+   }
+
    return argc;
 }
 
+
+// get the volume's block size 
+uint64_t get_block_size( struct UG_state* ug ) {
+
+   struct ms_client* ms = SG_gateway_ms( UG_state_gateway( ug ) );
+   return ms_client_get_volume_blocksize( ms );
+}
+
+
+// get the unit to size and align UG I/O to 
+uint64_t get_io_size( struct UG_state* ug, struct tool_opts* opts ) {
+
+   uint64_t io_size = opts->io_size;
+
+   if( io_size == 0 ) {
+      io_size = get_block_size( ug );
+   }
+
+   return std::max( io_size, (uint64_t)1 );
+}
+
+
+// round len down to a whole number of I/O units, but keep at least one
+uint64_t io_align( uint64_t len, uint64_t io_size ) {
+
+   if( len < io_size ) {
+      return io_size;
+   }
+
+   return len - (len % io_size);
+}
+
+
+// use fewer buffers until each one holds at least one I/O unit within buffer_size
+int io_depth( uint64_t buffer_size, uint64_t io_size, int depth ) {
+
+   if( buffer_size / io_size < 2 ) {
+      return -EINVAL;
+   }
+
+   if( (uint64_t)depth > buffer_size / io_size ) {
+
+      SG_debug("Using %d buffers instead of %d to fit in %" PRIu64 " bytes\n", (int)(buffer_size / io_size), depth, buffer_size );
+      depth = (int)(buffer_size / io_size);
+   }
+
+   return depth;
+}
+
+
+// check whether a buffer is all zeros.
+// once the head is known to be zero, the buffer is zero iff it equals itself shifted by the head's length;
+// memcmp does that comparison with the widest vector loads the CPU has.
+bool buf_is_zero( char const* buf, size_t len ) {
+
+   static char const zeros[16] = {0};
+   size_t head = std::min( len, sizeof(zeros) );
+
+   if( memcmp( buf, zeros, head ) != 0 ) {
+      return false;
+   }
+
+   return memcmp( buf, buf + head, len - head ) == 0;
+}
+
+
+// parse a byte count, with an optional K, M, or G suffix
+int parse_size( char const* str, uint64_t* ret ) {
+
+   char* tmp = NULL;
+   uint64_t size = 0;
+
+   if( *str < '0' || *str > '9' ) {
+      return -EINVAL;
+   }
+
+   size = (uint64_t)strtoull( str, &tmp, 10 );
+
+   switch( *tmp ) {
+
+      case '\0': {
+         break;
+      }
+      case 'k':
+      case 'K': {
+         size <<= 10;
+         tmp++;
+         break;
+      }
+      case 'm':
+      case 'M': {
+         size <<= 20;
+         tmp++;
+         break;
+      }
+      case 'g':
+      case 'G': {
+         size <<= 30;
+         tmp++;
+         break;
+      }
+      default: {
+         return -EINVAL;
+      }
+   }
+
+   if( *tmp != '\0' ) {
+      return -EINVAL;
+   }
+
+   *ret = size;
+   return 0;
+}
+
+
+// start a pool of threads that all run thread_main( cls ) 
+// return the number started, or -errno if none could be started
+int start_threads( pthread_t* threads, int num_threads, void* (*thread_main)(void*), void* cls ) {
+
+   int rc = 0;
+   int started = 0;
+
+   for( int i = 0; i < num_threads; i++ ) {
+
+      rc = pthread_create( &threads[i], NULL, thread_main, cls );
+      if( rc != 0 ) {
+         SG_error("pthread_create rc = %d\n", rc );
+         break;
+      }
+
+      started++;
+   }
+
+   if( started == 0 ) {
+      return -rc;
+   }
+
+   return started;
+}
+
+
+// wait for a pool of threads to finish 
+void join_threads( pthread_t* threads, int num_threads ) {
+
+   for( int i = 0; i < num_threads; i++ ) {
+      pthread_join( threads[i], NULL );
+   }
+}
+
 // usage 
 int usage( char const* progname, char const* args ) {
     
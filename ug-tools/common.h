@@ -32,16 +32,61 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <pthread.h>
+
 /**
  * @brief Available options
  *
- * Options are to enable or disable benchmarking
+ * Options are to enable or disable benchmarking, and to control
+ * how many transfers run at once and how much memory they use
  */
 struct tool_opts {
     
-    bool benchmark; ///< if true, gather benchmark stats
+    bool benchmark;        ///< if true, gather benchmark stats
+    int jobs;              ///< number of concurrent transfers (0 means the tool's default)
+    uint64_t buffer_size;  ///< total bytes of transfer buffers (0 means the tool's default)
+    int depth;             ///< number of transfer buffers in the pipeline (0 means the tool's default)
+    bool reread;           ///< if true, read each file a second time (for warm-cache benchmarks)
+    bool mmap;             ///< if true, map regular local files instead of reading them into buffers
+    uint64_t io_size;      ///< bytes per UG_read/UG_write unit (0 means the volume block size)
+    bool vectored;         ///< if true, fetch all ranges of a file through one handle, merging nearby ones
+    uint64_t gap;          ///< largest gap between two ranges that still get merged into one read
+    char* output;          ///< if not NULL, write ranges into this local file instead of printing them
+    bool resume;           ///< if true, keep a journal of completed ranges, and pick up where an interrupted transfer left off
+    bool update;           ///< if true, bring an existing local copy up to date, fetching only the blocks that differ
+    bool sparse;           ///< if true, skip holes (and with detect_zeros, zero blocks) instead of transferring them as data
+    bool detect_zeros;     ///< if true, also skip blocks that are all zeros
+    bool delta;            ///< if true, only write the blocks that differ from the existing remote file
+    uint64_t checkpoint;   ///< with resume, bytes to write between commits (0 means the tool's default)
+    uint64_t readahead;    ///< if nonzero, prefetch up to this many bytes ahead of sequential or strided ranges
+    bool recursive;        ///< if true, copy whole directory trees
+    bool group_commit;     ///< if true, fsync and close each upload in the background while the next one is written
+    bool skip_unchanged;   ///< if true, don't upload files whose contents match the digest published on the remote copy
 };
 
+/*
+ * Options that parse_args() accepts only from the tools that ask for them.
+ * -B (--benchmark) is accepted by every tool.
+ */
+#define TOOL_OPT_JOBS            0x0001     ///< -j, --jobs, --parallel
+#define TOOL_OPT_BUFFER          0x0002     ///< --buffer
+#define TOOL_OPT_DEPTH           0x0004     ///< --depth
+#define TOOL_OPT_REREAD          0x0008     ///< --reread
+#define TOOL_OPT_MMAP            0x0010     ///< --mmap
+#define TOOL_OPT_IO_SIZE         0x0020     ///< --io-size
+#define TOOL_OPT_VECTORED        0x0040     ///< --vectored, --gap
+#define TOOL_OPT_OUTPUT          0x0080     ///< --output
+#define TOOL_OPT_READAHEAD       0x0100     ///< --readahead
+#define TOOL_OPT_RESUME          0x0200     ///< --resume, and --checkpoint if TOOL_OPT_CHECKPOINT
+#define TOOL_OPT_CHECKPOINT      0x0400     ///< --checkpoint
+#define TOOL_OPT_DELTA           0x0800     ///< --delta
+#define TOOL_OPT_UPDATE          0x1000     ///< --update
+#define TOOL_OPT_SPARSE          0x2000     ///< --sparse
+#define TOOL_OPT_DETECT_ZEROS    0x4000     ///< --detect-zeros
+#define TOOL_OPT_RECURSIVE       0x8000     ///< -r, --recursive
+#define TOOL_OPT_GROUP_COMMIT    0x10000    ///< --group-commit
+#define TOOL_OPT_SKIP_UNCHANGED  0x20000    ///< --skip-unchanged
+
 /**
  * @brief 
  * Print a single entry
@@ -55,12 +100,105 @@ int print_entry( struct md_entry* dirent );
  * @brief 
  * Parse args for common tool options
  *
+ * Options the tool does not support are rejected.  Unsupported short options
+ * are left in argv for the gateway's own argument parser.
+ *
  * @param[in] argc Number of arguments
  * @param[in] argv Arguments
  * @param[in] opts Options (benchmarking)
+ * @param[in] supported TOOL_OPT_* flags for the options the tool accepts
  * @return The new argc
+ * @retval -EINVAL An option was invalid, or is not supported by the tool
+ */
+int parse_args( int argc, char** argv, struct tool_opts* opts, int supported );
+
+/**
+ * @brief 
+ * Get the volume's block size from the gateway
+ *
+ * @param[in] ug The UG state
+ * @return The block size in bytes
+ */
+uint64_t get_block_size( struct UG_state* ug );
+
+/**
+ * @brief 
+ * Get the unit that UG_read/UG_write requests are sized and aligned to:
+ * the --io-size option if given, and the volume block size otherwise
+ *
+ * @param[in] ug The UG state
+ * @param[in] opts Options (I/O size)
+ * @return The I/O unit in bytes (at least 1)
+ */
+uint64_t get_io_size( struct UG_state* ug, struct tool_opts* opts );
+
+/**
+ * @brief 
+ * Round a buffer length down to a whole number of I/O units, but no less than one unit
+ *
+ * @param[in] len Desired buffer length
+ * @param[in] io_size The I/O unit
+ * @return The buffer length to use
+ */
+uint64_t io_align( uint64_t len, uint64_t io_size );
+
+/**
+ * @brief 
+ * Fit a ring of transfer buffers of whole I/O units into a memory cap,
+ * by lowering the number of buffers (but not below 2)
+ *
+ * @param[in] buffer_size Most bytes the buffers may use in total
+ * @param[in] io_size The I/O unit
+ * @param[in] depth Desired number of buffers
+ * @return The number of buffers to use, each io_align( buffer_size / depth, io_size ) bytes
+ * @retval -EINVAL Two I/O units don't fit in buffer_size
+ */
+int io_depth( uint64_t buffer_size, uint64_t io_size, int depth );
+
+/**
+ * @brief 
+ * Check whether a buffer holds only zero bytes
+ *
+ * Runs at memory bandwidth, so it can be used on every block of a transfer.
+ *
+ * @param[in] buf The buffer
+ * @param[in] len Length of the buffer
+ * @return true if every byte is zero
+ */
+bool buf_is_zero( char const* buf, size_t len );
+
+/**
+ * @brief 
+ * Parse a byte count, with an optional K, M, or G suffix (powers of 1024)
+ *
+ * @param[in] str The string to parse
+ * @param[out] ret The byte count
+ * @retval 0 Success
+ * @retval -EINVAL Not a valid byte count
+ */
+int parse_size( char const* str, uint64_t* ret );
+
+/**
+ * @brief 
+ * Start a pool of threads that all run the same function
+ *
+ * @param[out] threads Thread IDs, which must have room for num_threads entries
+ * @param[in] num_threads Number of threads to start
+ * @param[in] thread_main Function each thread runs
+ * @param[in] cls Argument passed to each thread
+ * @retval >0 The number of threads started
+ * @retval -errno Failed to start any threads
+ */
+int start_threads( pthread_t* threads, int num_threads, void* (*thread_main)(void*), void* cls );
+
+/**
+ * @brief 
+ * Wait for a pool of threads started with start_threads() to finish
+ *
+ * @param[in] threads Thread IDs
+ * @param[in] num_threads Number of threads started
  */
-int parse_args( int argc, char** argv, struct tool_opts* opts );
+void join_threads( pthread_t* threads, int num_threads );
 
 /**
  * @brief 
@@ -0,0 +1,351 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file journal.cpp
+ *
+ * @brief On-disk journal of the byte ranges a transfer has completed
+ *
+ * @see journal.h
+ */
+
+#include "journal.h"
+
+#include <algorithm>
+
+#define JOURNAL_RECORD_MAX 64
+
+/**
+ * @brief An open journal
+ */
+struct journal {
+   char* path;                     ///< Path to the journal
+   int fd;                         ///< Open for appending
+   std::vector<struct journal_extent> done;    ///< Completed ranges, in the order recorded
+   pthread_mutex_t lock;           ///< Serializes appends
+};
+
+
+/**
+ * @brief Order extents by offset
+ */
+static bool journal_extent_cmp( struct journal_extent const& a, struct journal_extent const& b ) {
+   return a.offset < b.offset;
+}
+
+
+/**
+ * @brief Write all of buf, and fdatasync it
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int journal_write_sync( int fd, char const* buf, size_t len ) {
+
+   ssize_t nw = 0;
+
+   while( len > 0 ) {
+
+      nw = write( fd, buf, len );
+      if( nw < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         return -errno;
+      }
+
+      buf += nw;
+      len -= nw;
+   }
+
+   if( fdatasync( fd ) != 0 ) {
+      return -errno;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Load an existing journal's records, if its header matches
+ *
+ * Parsing stops at the first torn or malformed record, and the journal is cut off there.
+ *
+ * @retval JOURNAL_RESUMED The records were loaded
+ * @retval 0 The journal does not exist or belongs to another transfer
+ * @retval -errno Failure
+ */
+static int journal_load( struct journal* j, char const* header ) {
+
+   FILE* f = NULL;
+   char* line = NULL;
+   size_t line_len = 0;
+   ssize_t nr = 0;
+   off_t good = 0;
+   char* tmp = NULL;
+   struct journal_extent ext;
+
+   f = fopen( j->path, "r" );
+   if( f == NULL ) {
+
+      if( errno == ENOENT ) {
+         return 0;
+      }
+
+      return -errno;
+   }
+
+   // same transfer?
+   nr = getline( &line, &line_len, f );
+   if( nr <= 0 || line[nr-1] != '\n' || (size_t)(nr - 1) != strlen(header) || strncmp( line, header, nr - 1 ) != 0 ) {
+
+      SG_debug("Journal '%s' is for another transfer\n", j->path );
+      fclose( f );
+      SG_safe_free( line );
+      return 0;
+   }
+
+   good = nr;
+
+   while( true ) {
+
+      nr = getline( &line, &line_len, f );
+      if( nr <= 0 || line[nr-1] != '\n' ) {
+         break;
+      }
+
+      ext.offset = (uint64_t)strtoull( line, &tmp, 10 );
+      if( tmp == line || *tmp != ' ' ) {
+         break;
+      }
+
+      ext.len = (uint64_t)strtoull( tmp + 1, &tmp, 10 );
+      if( *tmp != '\n' ) {
+         break;
+      }
+
+      j->done.push_back( ext );
+      good += nr;
+   }
+
+   fclose( f );
+   SG_safe_free( line );
+
+   // drop a torn tail, so new records start on a line of their own
+   j->fd = open( j->path, O_WRONLY | O_APPEND );
+   if( j->fd < 0 ) {
+      return -errno;
+   }
+
+   if( ftruncate( j->fd, good ) != 0 ) {
+      return -errno;
+   }
+
+   SG_debug("Resuming journal '%s' with %zu records\n", j->path, j->done.size() );
+
+   return JOURNAL_RESUMED;
+}
+
+
+// open or resume a journal
+int journal_open( char const* path, char const* header, struct journal** ret ) {
+
+   int rc = 0;
+   char* buf = NULL;
+   struct journal* j = NULL;
+
+   j = SG_safe_new( struct journal );
+   if( j == NULL ) {
+      return -ENOMEM;
+   }
+
+   j->fd = -1;
+   j->path = SG_strdup_or_null( path );
+   if( j->path == NULL ) {
+      SG_safe_delete( j );
+      return -ENOMEM;
+   }
+
+   pthread_mutex_init( &j->lock, NULL );
+
+   rc = journal_load( j, header );
+   if( rc < 0 ) {
+
+      fprintf(stderr, "Failed to load journal '%s': %s\n", path, strerror(-rc));
+      journal_free( j );
+      return rc;
+   }
+
+   if( rc == 0 ) {
+
+      // start over
+      j->done.clear();
+
+      if( j->fd >= 0 ) {
+         close( j->fd );
+      }
+
+      j->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600 );
+      if( j->fd < 0 ) {
+
+         rc = -errno;
+         fprintf(stderr, "Failed to create journal '%s': %s\n", path, strerror(-rc));
+         journal_free( j );
+         return rc;
+      }
+
+      buf = SG_CALLOC( char, strlen(header) + 2 );
+      if( buf == NULL ) {
+         journal_free( j );
+         return -ENOMEM;
+      }
+
+      sprintf( buf, "%s\n", header );
+
+      rc = journal_write_sync( j->fd, buf, strlen(buf) );
+      SG_safe_free( buf );
+
+      if( rc != 0 ) {
+
+         fprintf(stderr, "Failed to write journal '%s': %s\n", path, strerror(-rc));
+         journal_free( j );
+         return rc;
+      }
+   }
+
+   *ret = j;
+   return rc;
+}
+
+
+// durably record a completed range
+int journal_append( struct journal* j, uint64_t offset, uint64_t len ) {
+
+   int rc = 0;
+   char buf[JOURNAL_RECORD_MAX];
+   struct journal_extent ext;
+
+   snprintf( buf, JOURNAL_RECORD_MAX, "%" PRIu64 " %" PRIu64 "\n", offset, len );
+
+   ext.offset = offset;
+   ext.len = len;
+
+   pthread_mutex_lock( &j->lock );
+
+   rc = journal_write_sync( j->fd, buf, strlen(buf) );
+   if( rc == 0 ) {
+      j->done.push_back( ext );
+   }
+
+   pthread_mutex_unlock( &j->lock );
+
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to write journal '%s': %s\n", j->path, strerror(-rc));
+   }
+
+   return rc;
+}
+
+
+// find the ranges of [0, size) that are not completed
+void journal_missing( struct journal* j, uint64_t size, std::vector<struct journal_extent>* missing ) {
+
+   std::vector<struct journal_extent> done;
+   struct journal_extent gap;
+   uint64_t pos = 0;
+
+   pthread_mutex_lock( &j->lock );
+   done = j->done;
+   pthread_mutex_unlock( &j->lock );
+
+   std::sort( done.begin(), done.end(), journal_extent_cmp );
+
+   missing->clear();
+
+   for( size_t i = 0; i < done.size() && pos < size; i++ ) {
+
+      if( done[i].offset > pos ) {
+
+         gap.offset = pos;
+         gap.len = std::min( done[i].offset, size ) - pos;
+         missing->push_back( gap );
+      }
+
+      pos = std::max( pos, done[i].offset + done[i].len );
+   }
+
+   if( pos < size ) {
+
+      gap.offset = pos;
+      gap.len = size - pos;
+      missing->push_back( gap );
+   }
+}
+
+
+// length of the completed prefix
+uint64_t journal_prefix( struct journal* j ) {
+
+   std::vector<struct journal_extent> done;
+   uint64_t pos = 0;
+
+   pthread_mutex_lock( &j->lock );
+   done = j->done;
+   pthread_mutex_unlock( &j->lock );
+
+   std::sort( done.begin(), done.end(), journal_extent_cmp );
+
+   for( size_t i = 0; i < done.size() && done[i].offset <= pos; i++ ) {
+      pos = std::max( pos, done[i].offset + done[i].len );
+   }
+
+   return pos;
+}
+
+
+// close and delete a journal
+int journal_remove( struct journal* j ) {
+
+   int rc = 0;
+
+   if( unlink( j->path ) != 0 ) {
+
+      rc = -errno;
+      fprintf(stderr, "Failed to remove journal '%s': %s\n", j->path, strerror(-rc));
+   }
+
+   journal_free( j );
+   return rc;
+}
+
+
+// close a journal
+void journal_free( struct journal* j ) {
+
+   if( j == NULL ) {
+      return;
+   }
+
+   if( j->fd >= 0 ) {
+      close( j->fd );
+   }
+
+   pthread_mutex_destroy( &j->lock );
+   SG_safe_free( j->path );
+   SG_safe_delete( j );
+}
@@ -0,0 +1,119 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file journal.h
+ *
+ * @brief On-disk journal of the byte ranges a transfer has completed
+ *
+ * A journal is a text file.  Its first line identifies the transfer (e.g.
+ * the remote file's ID and version), and every line after it records one
+ * completed range as "offset length".  Each record is fdatasync()'d before
+ * journal_append() returns, so after a crash the journal lists only ranges
+ * that really were completed.  A torn last record is ignored, and cut off
+ * when the journal is reopened.
+ *
+ * @see journal.cpp
+ */
+
+#ifndef _SYNDICATE_JOURNAL_H_
+#define _SYNDICATE_JOURNAL_H_
+
+#include <libsyndicate-ug/client.h>
+#include <libsyndicate-ug/core.h>
+
+#include <pthread.h>
+
+#include <vector>
+
+#define JOURNAL_RESUMED 1
+
+/**
+ * @brief A byte range of a file
+ */
+struct journal_extent {
+   uint64_t offset;                ///< Offset of the first byte
+   uint64_t len;                   ///< Number of bytes
+};
+
+/**
+ * @brief An open journal
+ */
+struct journal;
+
+/**
+ * @brief Open a journal, resuming it if it exists and belongs to the same transfer
+ *
+ * If the journal at path does not exist, or its first line is not header, it is
+ * started over with header and no ranges.
+ *
+ * @param[in] path Path to the journal
+ * @param[in] header One line (without a newline) that identifies the transfer
+ * @param[out] ret The open journal
+ * @retval 0 A new journal was started
+ * @retval JOURNAL_RESUMED The existing journal was loaded
+ * @retval -errno Failure
+ */
+int journal_open( char const* path, char const* header, struct journal** ret );
+
+/**
+ * @brief Durably record that a range was completed
+ *
+ * Safe to call from several threads at once.  The data in the range must
+ * already be durable.
+ *
+ * @param[in] j The journal
+ * @param[in] offset Offset of the range
+ * @param[in] len Length of the range
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+int journal_append( struct journal* j, uint64_t offset, uint64_t len );
+
+/**
+ * @brief Get the ranges of [0, size) that the journal does not cover, in offset order
+ *
+ * @param[in] j The journal
+ * @param[in] size Size of the file
+ * @param[out] missing The ranges that are not completed
+ */
+void journal_missing( struct journal* j, uint64_t size, std::vector<struct journal_extent>* missing );
+
+/**
+ * @brief Get the number of bytes from offset 0 that the journal covers without a gap
+ *
+ * @param[in] j The journal
+ * @return The length of the completed prefix
+ */
+uint64_t journal_prefix( struct journal* j );
+
+/**
+ * @brief Close a journal and delete it, once its transfer is complete
+ *
+ * @param[in] j The journal (freed)
+ * @retval 0 Success
+ * @retval -errno Failed to delete the journal (it is still freed)
+ */
+int journal_remove( struct journal* j );
+
+/**
+ * @brief Close a journal, leaving it on disk so the transfer can be resumed
+ *
+ * @param[in] j The journal (may be NULL)
+ */
+void journal_free( struct journal* j );
+
+#endif
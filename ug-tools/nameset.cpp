@@ -0,0 +1,187 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file nameset.cpp
+ *
+ * @brief Which of a batch of paths already exist in the volume
+ *
+ * @see nameset.h
+ */
+
+#include "nameset.h"
+
+/**
+ * @brief Names found in the parent directories of a batch of paths
+ */
+struct nameset {
+   std::map<std::string, std::set<std::string> > dirs;     ///< Names in each listed directory
+};
+
+
+/**
+ * @brief Split a path into its parent directory and its name
+ */
+static void nameset_split( char const* path, std::string* dir, std::string* name ) {
+
+   char const* slash = strrchr( path, '/' );
+
+   if( slash == NULL ) {
+      *dir = "/";
+      *name = path;
+   }
+   else if( slash == path ) {
+      *dir = "/";
+      *name = slash + 1;
+   }
+   else {
+      dir->assign( path, slash - path );
+      *name = slash + 1;
+   }
+}
+
+
+/**
+ * @brief Read the names in a directory
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int nameset_list( struct UG_state* ug, char const* dir, std::set<std::string>* names ) {
+
+   int rc = 0;
+   UG_handle_t* dirh = NULL;
+   struct md_entry** dirents = NULL;
+
+   dirh = UG_opendir( ug, dir, &rc );
+   if( dirh == NULL ) {
+      return (rc != 0 ? rc : -EIO);
+   }
+
+   while( true ) {
+
+      rc = UG_readdir( ug, &dirents, 1, dirh );
+      if( rc != 0 ) {
+         break;
+      }
+
+      if( dirents == NULL ) {
+         break;
+      }
+
+      if( dirents[0] == NULL ) {
+
+         // EOF
+         UG_free_dir_listing( dirents );
+         break;
+      }
+
+      for( unsigned int j = 0; dirents[j] != NULL; j++ ) {
+         names->insert( std::string( dirents[j]->name ) );
+      }
+
+      UG_free_dir_listing( dirents );
+      dirents = NULL;
+   }
+
+   UG_closedir( ug, dirh );
+   return rc;
+}
+
+
+// list the parent directories of a batch of paths
+int nameset_build( struct UG_state* ug, char const* const* paths, int num_paths, struct nameset** ret ) {
+
+   int rc = 0;
+   struct nameset* ns = NULL;
+   std::map<std::string, int> counts;
+   std::map<std::string, int>::iterator itr;
+   std::set<std::string> names;
+   std::string dir;
+   std::string name;
+
+   ns = SG_safe_new( struct nameset );
+   if( ns == NULL ) {
+      return -ENOMEM;
+   }
+
+   for( int i = 0; i < num_paths; i++ ) {
+
+      nameset_split( paths[i], &dir, &name );
+      counts[dir]++;
+   }
+
+   for( itr = counts.begin(); itr != counts.end(); itr++ ) {
+
+      if( itr->second < NAMESET_MIN_PATHS ) {
+         continue;
+      }
+
+      names.clear();
+
+      rc = nameset_list( ug, itr->first.c_str(), &names );
+      if( rc == -ENOENT ) {
+
+         // nothing in it exists yet
+         names.clear();
+         rc = 0;
+      }
+
+      if( rc != 0 ) {
+
+         // don't guess; those paths take the slow way
+         SG_debug("Failed to list '%s': %s\n", itr->first.c_str(), strerror( abs(rc) ) );
+         rc = 0;
+         continue;
+      }
+
+      ns->dirs[ itr->first ].swap( names );
+   }
+
+   SG_debug("Listed %zu of %zu directories\n", ns->dirs.size(), counts.size() );
+
+   *ret = ns;
+   return 0;
+}
+
+
+// look up a path in a name set
+int nameset_lookup( struct nameset* ns, char const* path ) {
+
+   std::map<std::string, std::set<std::string> >::iterator itr;
+   std::string dir;
+   std::string name;
+
+   nameset_split( path, &dir, &name );
+
+   itr = ns->dirs.find( dir );
+   if( itr == ns->dirs.end() ) {
+      return NAMESET_UNKNOWN;
+   }
+
+   if( itr->second.count( name ) > 0 ) {
+      return NAMESET_EXISTS;
+   }
+
+   return NAMESET_ABSENT;
+}
+
+
+// free a name set
+void nameset_free( struct nameset* ns ) {
+
+   SG_safe_delete( ns );
+}
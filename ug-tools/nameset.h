@@ -0,0 +1,89 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file nameset.h
+ *
+ * @brief Which of a batch of paths already exist in the volume
+ *
+ * Tools that create-or-update many files would otherwise try UG_create on
+ * each one and fall back when it fails with -EEXIST, which costs a wasted
+ * metadata request per existing file.  A name set lists each distinct
+ * parent directory of the batch once, up front, so each file can go
+ * straight to the right call.  The listing can go stale, so callers must
+ * still fall back if the call they picked fails because of a race.
+ *
+ * @see nameset.cpp
+ */
+
+#ifndef _SYNDICATE_NAMESET_H_
+#define _SYNDICATE_NAMESET_H_
+
+#include <libsyndicate-ug/client.h>
+#include <libsyndicate-ug/core.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+// a directory is only listed if at least this many paths in the batch are in it
+#define NAMESET_MIN_PATHS 2
+
+#define NAMESET_UNKNOWN 0
+#define NAMESET_EXISTS 1
+#define NAMESET_ABSENT 2
+
+/**
+ * @brief Names found in the parent directories of a batch of paths
+ */
+struct nameset;
+
+/**
+ * @brief List the parent directories of a batch of paths
+ *
+ * Each parent directory is listed once.  Directories with fewer than
+ * NAMESET_MIN_PATHS paths in the batch are not listed, since a failed create
+ * costs no more than the listing.  A directory that does not exist counts as
+ * empty.  A directory that can't be listed for another reason is skipped.
+ *
+ * @param[in] ug The UG state
+ * @param[in] paths Paths in the volume
+ * @param[in] num_paths Number of paths
+ * @param[out] ret The name set
+ * @retval 0 Success
+ * @retval -ENOMEM Out of memory
+ */
+int nameset_build( struct UG_state* ug, char const* const* paths, int num_paths, struct nameset** ret );
+
+/**
+ * @brief Look up a path in a name set
+ *
+ * @param[in] ns The name set
+ * @param[in] path Path in the volume
+ * @retval NAMESET_EXISTS The path existed when its directory was listed
+ * @retval NAMESET_ABSENT The path did not exist when its directory was listed
+ * @retval NAMESET_UNKNOWN Its directory was not listed
+ */
+int nameset_lookup( struct nameset* ns, char const* path );
+
+/**
+ * @brief Free a name set
+ *
+ * @param[in] ns The name set (may be NULL)
+ */
+void nameset_free( struct nameset* ns );
+
+#endif
@@ -0,0 +1,564 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file pipeline.cpp
+ *
+ * @brief Pipelined transfer core shared by the transfer tools
+ *
+ * @see pipeline.h
+ */
+
+#include "pipeline.h"
+
+#define PIPELINE_MMAP_WINDOW 1024 * 1024 * 64
+
+/**
+ * @brief A ring of page-aligned transfer buffers, and the queues that move them between stages
+ */
+struct pipeline {
+   char** bufs;                    ///< Buffers
+   size_t buf_len;                 ///< Length of each buffer
+   int depth;                      ///< Number of buffers
+
+   int* full;                      ///< Ring of filled buffer indexes, in fill order
+   size_t* full_len;               ///< Number of bytes in each filled buffer
+   int full_head;                  ///< Index into full of the oldest filled buffer
+   int full_count;                 ///< Number of filled buffers
+
+   int* empty;                     ///< Stack of empty buffer indexes
+   int empty_count;                ///< Number of empty buffers
+
+   uint64_t retire_bytes;          ///< Bytes that must be drained after a retired buffer before it is reused
+   int* retired;                   ///< Ring of drained buffers that may still be referenced, oldest first
+   uint64_t* retired_at;           ///< Value of drained when each retired buffer was drained
+   int retired_head;               ///< Index into retired of the oldest retired buffer
+   int retired_count;              ///< Number of retired buffers (kept across runs)
+   uint64_t drained;               ///< Bytes drained over the life of the pipeline
+
+   bool fill_done;                 ///< if true, the fill stage hit EOF or failed
+   bool stop;                      ///< if true, the drain stage failed and the fill stage should stop
+
+   pipeline_fill_func fill;        ///< Fill stage callback for the current run
+   void* fill_cls;                 ///< Fill stage closure for the current run
+   int fill_rc;                    ///< Fill stage error for the current run
+   int64_t fill_ns;                ///< Time spent in the fill callback in the current run
+   int64_t fill_wait_ns;           ///< Time the fill stage spent waiting in the current run
+
+   pthread_mutex_t lock;           ///< Lock protecting the queues
+   pthread_cond_t filled;          ///< Signaled when a buffer is filled, or the fill stage finishes
+   pthread_cond_t emptied;         ///< Signaled when a buffer is drained, or the drain stage stops
+};
+
+
+// make a pipeline with depth buffers of buf_len bytes each
+struct pipeline* pipeline_new( size_t buf_len, int depth ) {
+
+   struct pipeline* pl = NULL;
+   void* buf = NULL;
+   
+   pl = SG_CALLOC( struct pipeline, 1 );
+   if( pl == NULL ) {
+      return NULL;
+   }
+
+   pl->buf_len = buf_len;
+   pl->depth = std::max( depth, 2 );
+
+   pl->bufs = SG_CALLOC( char*, pl->depth );
+   pl->full = SG_CALLOC( int, pl->depth );
+   pl->full_len = SG_CALLOC( size_t, pl->depth );
+   pl->empty = SG_CALLOC( int, pl->depth );
+   pl->retired = SG_CALLOC( int, pl->depth );
+   pl->retired_at = SG_CALLOC( uint64_t, pl->depth );
+
+   if( pl->bufs == NULL || pl->full == NULL || pl->full_len == NULL || pl->empty == NULL || pl->retired == NULL || pl->retired_at == NULL ) {
+      pipeline_free( pl );
+      return NULL;
+   }
+
+   // map buffers directly, so they are page-aligned and their pages are never handed
+   // to another allocation while something outside the process still refers to them
+   for( int i = 0; i < pl->depth; i++ ) {
+
+      buf = mmap( NULL, buf_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( buf == MAP_FAILED ) {
+         pipeline_free( pl );
+         return NULL;
+      }
+
+      pl->bufs[i] = (char*)buf;
+   }
+
+   pthread_mutex_init( &pl->lock, NULL );
+   pthread_cond_init( &pl->filled, NULL );
+   pthread_cond_init( &pl->emptied, NULL );
+
+   return pl;
+}
+
+
+// free a pipeline 
+void pipeline_free( struct pipeline* pl ) {
+
+   if( pl == NULL ) {
+      return;
+   }
+
+   if( pl->bufs != NULL ) {
+
+      // fully set up 
+      if( pl->bufs[pl->depth - 1] != NULL ) {
+         pthread_mutex_destroy( &pl->lock );
+         pthread_cond_destroy( &pl->filled );
+         pthread_cond_destroy( &pl->emptied );
+      }
+
+      for( int i = 0; i < pl->depth; i++ ) {
+         if( pl->bufs[i] != NULL ) {
+            munmap( pl->bufs[i], pl->buf_len );
+         }
+      }
+   }
+
+   SG_safe_free( pl->bufs );
+   SG_safe_free( pl->full );
+   SG_safe_free( pl->full_len );
+   SG_safe_free( pl->empty );
+   SG_safe_free( pl->retired );
+   SG_safe_free( pl->retired_at );
+   SG_safe_free( pl );
+}
+
+
+// get the length of each buffer 
+size_t pipeline_buf_len( struct pipeline* pl ) {
+   return pl->buf_len;
+}
+
+
+// get the number of buffers 
+int pipeline_depth( struct pipeline* pl ) {
+   return pl->depth;
+}
+
+
+// hold retired buffers until retire_bytes more bytes have been drained 
+void pipeline_set_retire( struct pipeline* pl, uint64_t retire_bytes ) {
+   pl->retire_bytes = retire_bytes;
+}
+
+
+/**
+ * @brief Hand back a drained buffer, holding it if the drain stage retired it.
+ * Then hand back any retired buffers that have had enough bytes drained after them.
+ * pl->lock must be held.
+ *
+ * @param[in] pl The pipeline
+ * @param[in] idx The drained buffer
+ * @param[in] len Number of bytes drained from it
+ * @param[in] retire if true, the drain stage still refers to the buffer
+ */
+static void pipeline_put_drained( struct pipeline* pl, int idx, size_t len, bool retire ) {
+
+   int oldest = 0;
+
+   pl->drained += len;
+
+   if( retire ) {
+      pl->retired[ (pl->retired_head + pl->retired_count) % pl->depth ] = idx;
+      pl->retired_at[ (pl->retired_head + pl->retired_count) % pl->depth ] = pl->drained;
+      pl->retired_count++;
+   }
+   else {
+      pl->empty[ pl->empty_count ] = idx;
+      pl->empty_count++;
+   }
+
+   while( pl->retired_count > 0 && pl->drained - pl->retired_at[ pl->retired_head ] >= pl->retire_bytes ) {
+
+      oldest = pl->retired[ pl->retired_head ];
+      pl->retired_head = (pl->retired_head + 1) % pl->depth;
+      pl->retired_count--;
+
+      pl->empty[ pl->empty_count ] = oldest;
+      pl->empty_count++;
+   }
+}
+
+
+/**
+ * @brief Fill stage thread: fill empty buffers and queue them for the drain stage, until EOF or error
+ *
+ * @param[in] arg The pipeline
+ * @return NULL
+ */
+static void* pipeline_fill_main( void* arg ) {
+
+   struct pipeline* pl = (struct pipeline*)arg;
+   int idx = 0;
+   ssize_t nr = 0;
+   struct timespec ts_begin;
+   struct timespec ts_end;
+
+   while( 1 ) {
+
+      // get an empty buffer 
+      pthread_mutex_lock( &pl->lock );
+
+      clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+      while( pl->empty_count == 0 && !pl->stop ) {
+         pthread_cond_wait( &pl->emptied, &pl->lock );
+      }
+      clock_gettime( CLOCK_MONOTONIC, &ts_end );
+
+      pl->fill_wait_ns += md_timespec_diff( &ts_end, &ts_begin );
+
+      if( pl->stop ) {
+         pl->fill_done = true;
+         pthread_cond_signal( &pl->filled );
+         pthread_mutex_unlock( &pl->lock );
+         break;
+      }
+
+      pl->empty_count--;
+      idx = pl->empty[ pl->empty_count ];
+
+      pthread_mutex_unlock( &pl->lock );
+
+      clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+      nr = (*pl->fill)( pl->fill_cls, pl->bufs[idx], pl->buf_len );
+      clock_gettime( CLOCK_MONOTONIC, &ts_end );
+
+      pthread_mutex_lock( &pl->lock );
+
+      pl->fill_ns += md_timespec_diff( &ts_end, &ts_begin );
+
+      if( nr <= 0 ) {
+
+         // EOF or error
+         pl->fill_rc = (int)nr;
+         pl->empty[ pl->empty_count ] = idx;
+         pl->empty_count++;
+         pl->fill_done = true;
+
+         pthread_cond_signal( &pl->filled );
+         pthread_mutex_unlock( &pl->lock );
+         break;
+      }
+
+      pl->full[ (pl->full_head + pl->full_count) % pl->depth ] = idx;
+      pl->full_len[ (pl->full_head + pl->full_count) % pl->depth ] = nr;
+      pl->full_count++;
+
+      pthread_cond_signal( &pl->filled );
+      pthread_mutex_unlock( &pl->lock );
+   }
+
+   return NULL;
+}
+
+
+// move bytes from fill to drain 
+// return 0 on success, or the first error from either stage
+int pipeline_run( struct pipeline* pl, pipeline_fill_func fill, void* fill_cls, pipeline_drain_func drain, void* drain_cls, struct pipeline_stats* stats ) {
+
+   int rc = 0;
+   int idx = 0;
+   size_t len = 0;
+   pthread_t fill_thread;
+   struct timespec ts_begin;
+   struct timespec ts_end;
+
+   memset( stats, 0, sizeof(struct pipeline_stats) );
+
+   // all buffers start out empty, except those still retired from the last run 
+   pl->empty_count = 0;
+   for( int i = 0; i < pl->depth; i++ ) {
+
+      bool retired = false;
+      for( int j = 0; j < pl->retired_count; j++ ) {
+         if( pl->retired[ (pl->retired_head + j) % pl->depth ] == i ) {
+            retired = true;
+            break;
+         }
+      }
+
+      if( !retired ) {
+         pl->empty[ pl->empty_count ] = i;
+         pl->empty_count++;
+      }
+   }
+
+   pl->full_head = 0;
+   pl->full_count = 0;
+   pl->fill_done = false;
+   pl->stop = false;
+   pl->fill = fill;
+   pl->fill_cls = fill_cls;
+   pl->fill_rc = 0;
+   pl->fill_ns = 0;
+   pl->fill_wait_ns = 0;
+
+   rc = pthread_create( &fill_thread, NULL, pipeline_fill_main, pl );
+   if( rc != 0 ) {
+      SG_error("pthread_create rc = %d\n", rc );
+      return -rc;
+   }
+
+   while( 1 ) {
+
+      // get the next full buffer 
+      pthread_mutex_lock( &pl->lock );
+
+      clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+      while( pl->full_count == 0 && !pl->fill_done ) {
+         pthread_cond_wait( &pl->filled, &pl->lock );
+      }
+      clock_gettime( CLOCK_MONOTONIC, &ts_end );
+
+      stats->drain_wait_ns += md_timespec_diff( &ts_end, &ts_begin );
+
+      if( pl->full_count == 0 ) {
+
+         // fill stage is done, and everything it filled has been drained
+         pthread_mutex_unlock( &pl->lock );
+         break;
+      }
+
+      idx = pl->full[ pl->full_head ];
+      len = pl->full_len[ pl->full_head ];
+      pl->full_head = (pl->full_head + 1) % pl->depth;
+      pl->full_count--;
+
+      pthread_mutex_unlock( &pl->lock );
+
+      clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+      rc = (*drain)( drain_cls, pl->bufs[idx], len );
+      clock_gettime( CLOCK_MONOTONIC, &ts_end );
+
+      stats->drain_ns += md_timespec_diff( &ts_end, &ts_begin );
+
+      // give it back 
+      pthread_mutex_lock( &pl->lock );
+
+      if( rc < 0 ) {
+         pl->empty[ pl->empty_count ] = idx;
+         pl->empty_count++;
+         pl->stop = true;
+      }
+      else {
+         pipeline_put_drained( pl, idx, len, rc == PIPELINE_DRAIN_RETIRE );
+      }
+
+      pthread_cond_signal( &pl->emptied );
+      pthread_mutex_unlock( &pl->lock );
+
+      if( rc < 0 ) {
+         stats->drain_rc = rc;
+         break;
+      }
+
+      stats->bytes += len;
+   }
+
+   pthread_join( fill_thread, NULL );
+
+   stats->fill_rc = pl->fill_rc;
+   stats->fill_ns = pl->fill_ns;
+   stats->fill_wait_ns = pl->fill_wait_ns;
+
+   if( stats->drain_rc != 0 ) {
+      return stats->drain_rc;
+   }
+
+   return stats->fill_rc;
+}
+
+
+// drain a regular file straight out of a sliding memory mapping 
+int pipeline_mmap_run( int fd, off_t size, size_t head_len, size_t drain_len, pipeline_drain_func drain, void* drain_cls, struct pipeline_stats* stats ) {
+
+   int rc = 0;
+   long page_size = sysconf( _SC_PAGESIZE );
+   off_t window = 0;
+   off_t start = 0;
+   off_t end = 0;
+   off_t map_offset = 0;
+   size_t map_len = 0;
+   size_t len = 0;
+   char* map = NULL;
+   char* data = NULL;
+   struct timespec ts_begin;
+   struct timespec ts_end;
+
+   memset( stats, 0, sizeof(struct pipeline_stats) );
+
+   // windows are a whole number of drain calls
+   window = std::max( ((off_t)(PIPELINE_MMAP_WINDOW) / (off_t)drain_len) * (off_t)drain_len, (off_t)drain_len );
+
+   for( start = 0; start < size; start = end ) {
+
+      // the head gets a window of its own, so every later window starts on a drain call boundary
+      if( start == 0 && head_len > 0 ) {
+         end = std::min( (off_t)head_len, size );
+      }
+      else {
+         end = std::min( start + window, size );
+      }
+
+      // mappings must start on a page boundary
+      map_offset = start - (start % page_size);
+      map_len = end - map_offset;
+
+      map = (char*)mmap( NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_offset );
+      if( map == MAP_FAILED ) {
+         stats->fill_rc = -errno;
+         return stats->fill_rc;
+      }
+
+      madvise( map, map_len, MADV_SEQUENTIAL );
+
+      // start reading the next window while this one drains
+      if( end < size ) {
+         posix_fadvise( fd, end, std::min( window, size - end ), POSIX_FADV_WILLNEED );
+      }
+
+      data = map + (start - map_offset);
+
+      for( off_t pos = 0; pos < end - start; pos += len ) {
+
+         len = std::min( (off_t)drain_len, end - start - pos );
+
+         clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+         rc = (*drain)( drain_cls, data + pos, len );
+         clock_gettime( CLOCK_MONOTONIC, &ts_end );
+
+         stats->drain_ns += md_timespec_diff( &ts_end, &ts_begin );
+
+         if( rc < 0 ) {
+            stats->drain_rc = rc;
+            munmap( map, map_len );
+            return rc;
+         }
+
+         stats->bytes += len;
+      }
+
+      munmap( map, map_len );
+   }
+
+   return 0;
+}
+
+
+// fill from a local file 
+ssize_t pipeline_fill_local( void* cls, char* buf, size_t len ) {
+
+   struct pipeline_local* local = (struct pipeline_local*)cls;
+   ssize_t nr = 0;
+   size_t total = 0;
+
+   if( local->head_len > 0 ) {
+      len = std::min( len, local->head_len );
+      local->head_len = 0;
+   }
+
+   while( total < len ) {
+
+      nr = read( local->fd, buf + total, len - total );
+      if( nr < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         return -errno;
+      }
+      if( nr == 0 ) {
+         break;
+      }
+
+      total += nr;
+   }
+
+   return total;
+}
+
+
+// drain to a local file 
+int pipeline_drain_local( void* cls, char* buf, size_t len ) {
+
+   struct pipeline_local* local = (struct pipeline_local*)cls;
+   ssize_t nw = 0;
+   size_t total = 0;
+
+   while( total < len ) {
+
+      nw = write( local->fd, buf + total, len - total );
+      if( nw < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         return -errno;
+      }
+
+      total += nw;
+   }
+
+   return 0;
+}
+
+
+// fill from a UG file 
+ssize_t pipeline_fill_ug( void* cls, char* buf, size_t len ) {
+
+   struct pipeline_ug* ugf = (struct pipeline_ug*)cls;
+   ssize_t nr = 0;
+   size_t total = 0;
+
+   while( total < len ) {
+
+      nr = UG_read( ugf->ug, buf + total, len - total, ugf->fh );
+      if( nr < 0 ) {
+         return nr;
+      }
+      if( nr == 0 ) {
+         break;
+      }
+
+      total += nr;
+   }
+
+   return total;
+}
+
+
+// drain to a UG file 
+int pipeline_drain_ug( void* cls, char* buf, size_t len ) {
+
+   struct pipeline_ug* ugf = (struct pipeline_ug*)cls;
+   int rc = 0;
+
+   rc = UG_write( ugf->ug, buf, len, ugf->fh );
+   if( rc < 0 ) {
+      return rc;
+   }
+
+   return 0;
+}
@@ -0,0 +1,207 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file pipeline.h
+ *
+ * @brief Pipelined transfer core shared by the transfer tools
+ *
+ * A pipeline moves a stream of bytes from a fill stage to a drain stage
+ * through a bounded ring of buffers.  The fill stage runs on its own thread,
+ * filling the next buffer while the calling thread drains the current one.
+ * When every buffer is full, the fill stage blocks until the drain stage
+ * hands one back.
+ *
+ * @see pipeline.cpp
+ */
+
+#ifndef _SYNDICATE_PIPELINE_H_
+#define _SYNDICATE_PIPELINE_H_
+
+#include <libsyndicate-ug/client.h>
+#include <libsyndicate-ug/core.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define PIPELINE_DRAIN_RETIRE 1
+
+/**
+ * @brief Fill stage callback: put up to len bytes into buf
+ *
+ * @return The number of bytes put into buf
+ * @retval 0 EOF
+ * @retval -errno Failure
+ */
+typedef ssize_t (*pipeline_fill_func)( void* cls, char* buf, size_t len );
+
+/**
+ * @brief Drain stage callback: consume all len bytes in buf
+ *
+ * @retval 0 Success
+ * @retval PIPELINE_DRAIN_RETIRE Success, but buf is still referenced (see pipeline_set_retire())
+ * @retval -errno Failure
+ */
+typedef int (*pipeline_drain_func)( void* cls, char* buf, size_t len );
+
+/**
+ * @brief Outcome of running a pipeline
+ *
+ * A stage that spends much of its time waiting is not the bottleneck.
+ */
+struct pipeline_stats {
+   uint64_t bytes;                 ///< Bytes drained
+   int fill_rc;                    ///< 0, or the error from the fill stage
+   int drain_rc;                   ///< 0, or the error from the drain stage
+   int64_t fill_ns;                ///< Time spent in the fill callback
+   int64_t fill_wait_ns;           ///< Time the fill stage spent waiting for an empty buffer
+   int64_t drain_ns;               ///< Time spent in the drain callback
+   int64_t drain_wait_ns;          ///< Time the drain stage spent waiting for a full buffer
+};
+
+/**
+ * @brief A ring of page-aligned transfer buffers
+ */
+struct pipeline;
+
+/**
+ * @brief Fill/drain closure for a local file descriptor
+ */
+struct pipeline_local {
+   int fd;                         ///< Local file descriptor
+   size_t head_len;                ///< If nonzero, the first fill stops after this many bytes, so later fills start on an I/O unit boundary
+};
+
+/**
+ * @brief Fill/drain closure for a UG file handle
+ */
+struct pipeline_ug {
+   struct UG_state* ug;            ///< The UG state
+   UG_handle_t* fh;                ///< Open file handle
+};
+
+/**
+ * @brief Make a pipeline
+ *
+ * @param[in] buf_len Length of each buffer
+ * @param[in] depth Number of buffers (at least 2)
+ * @return A new pipeline, or NULL if out of memory
+ */
+struct pipeline* pipeline_new( size_t buf_len, int depth );
+
+/**
+ * @brief Free a pipeline and its buffers
+ *
+ * @param[in] pl The pipeline
+ */
+void pipeline_free( struct pipeline* pl );
+
+/**
+ * @brief Get the length of each of a pipeline's buffers
+ *
+ * @param[in] pl The pipeline
+ * @return The buffer length
+ */
+size_t pipeline_buf_len( struct pipeline* pl );
+
+/**
+ * @brief Get the number of buffers in a pipeline
+ *
+ * @param[in] pl The pipeline
+ * @return The number of buffers
+ */
+int pipeline_depth( struct pipeline* pl );
+
+/**
+ * @brief Hold buffers that the drain stage retires until more data has been drained after them
+ *
+ * A drain stage that hands out references to its buffers instead of copying them
+ * (e.g. with vmsplice) returns PIPELINE_DRAIN_RETIRE.  The pipeline then waits until
+ * retire_bytes more bytes have been drained before filling that buffer again, and keeps
+ * waiting across runs.  Every retired buffer must hold at least
+ * retire_bytes / (depth - 2) bytes, or the pipeline can run out of buffers.
+ *
+ * @param[in] pl The pipeline
+ * @param[in] retire_bytes Bytes to drain after a retired buffer before reusing it
+ */
+void pipeline_set_retire( struct pipeline* pl, uint64_t retire_bytes );
+
+/**
+ * @brief Move bytes from fill to drain until fill hits EOF or either stage fails
+ *
+ * Drained buffers are handed back to the fill stage once drain returns.
+ * The pipeline can be run again once this returns.
+ *
+ * @param[in] pl The pipeline
+ * @param[in] fill Fill stage callback, called on a separate thread
+ * @param[in] fill_cls Fill stage closure
+ * @param[in] drain Drain stage callback, called on the calling thread
+ * @param[in] drain_cls Drain stage closure
+ * @param[out] stats Bytes moved and per-stage errors
+ * @retval 0 Success
+ * @retval -errno The first error from either stage (see stats for which one)
+ */
+int pipeline_run( struct pipeline* pl, pipeline_fill_func fill, void* fill_cls, pipeline_drain_func drain, void* drain_cls, struct pipeline_stats* stats );
+
+/**
+ * @brief Drain a regular local file straight out of a memory mapping, without copying it into buffers
+ *
+ * The file is mapped one window at a time.  Each window is passed to drain in slices of
+ * drain_len bytes, and the kernel is asked to read ahead the next window while the
+ * current one drains.  This is the zero-copy alternative to pipeline_run() with
+ * pipeline_fill_local(), for regular files only.
+ *
+ * @param[in] fd Local file descriptor of a regular file
+ * @param[in] size Number of bytes to drain, starting at offset 0
+ * @param[in] head_len If nonzero, the first drain call covers only this many bytes, so later calls start on an I/O unit boundary
+ * @param[in] drain_len Bytes per drain call
+ * @param[in] drain Drain stage callback
+ * @param[in] drain_cls Drain stage closure
+ * @param[out] stats Bytes moved and errors; mapping failures are reported in fill_rc
+ * @retval 0 Success
+ * @retval -errno The first error (see stats for which stage)
+ */
+int pipeline_mmap_run( int fd, off_t size, size_t head_len, size_t drain_len, pipeline_drain_func drain, void* drain_cls, struct pipeline_stats* stats );
+
+/**
+ * @brief Fill stage for a local file: read() until the buffer is full or EOF
+ *
+ * @param[in] cls A struct pipeline_local
+ */
+ssize_t pipeline_fill_local( void* cls, char* buf, size_t len );
+
+/**
+ * @brief Drain stage for a local file: write() the whole buffer
+ *
+ * @param[in] cls A struct pipeline_local
+ */
+int pipeline_drain_local( void* cls, char* buf, size_t len );
+
+/**
+ * @brief Fill stage for a UG file: UG_read() until the buffer is full or EOF
+ *
+ * @param[in] cls A struct pipeline_ug
+ */
+ssize_t pipeline_fill_ug( void* cls, char* buf, size_t len );
+
+/**
+ * @brief Drain stage for a UG file: UG_write() the whole buffer
+ *
+ * @param[in] cls A struct pipeline_ug
+ */
+int pipeline_drain_ug( void* cls, char* buf, size_t len );
+
+#endif
@@ -0,0 +1,524 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file readahead.cpp
+ *
+ * @brief Adaptive readahead for a stream of range reads on one file
+ *
+ * @see readahead.h
+ */
+
+#include "readahead.h"
+
+#define READAHEAD_INITIAL_UNITS 4
+
+/**
+ * @brief A prefetched (or soon to be prefetched) stretch of the file
+ */
+struct readahead_window {
+   uint64_t offset;                ///< Offset in the file
+   uint64_t len;                   ///< Bytes asked for
+   char* data;                     ///< The window's bytes, once fetched
+   uint64_t data_len;              ///< Bytes fetched (less than len at EOF)
+   bool fetching;                  ///< if true, the fetch thread is reading it
+   bool done;                      ///< if true, the fetch finished (see rc)
+   bool dropped;                   ///< if true, it was dropped while being read, and the fetch thread frees it
+   bool used;                      ///< if true, readahead_get() returned bytes from it
+   int rc;                         ///< 0, or the fetch error
+};
+
+/**
+ * @brief Readahead state for one file
+ */
+struct readahead {
+   struct UG_state* ug;            ///< The UG state
+   char* path;                     ///< Path to the file
+   uint64_t io_size;               ///< Windows are aligned to this
+   uint64_t max_window;            ///< Largest window
+   uint64_t window;                ///< Current window
+
+   bool have_last;                 ///< if true, last_offset and last_len are set
+   uint64_t last_offset;           ///< Offset of the last range
+   uint64_t last_len;              ///< Length of the last range
+   uint64_t stride;                ///< Distance between the last two range offsets
+   int streak;                     ///< Number of ranges in a row that continued the pattern
+
+   uint64_t frontier;              ///< End of the furthest window asked for
+   bool eof_known;                 ///< if true, eof is set
+   uint64_t eof;                   ///< Size of the file, as found by a short fetch
+
+   std::deque<struct readahead_window*> windows;   ///< Windows, by offset
+
+   UG_handle_t* fh;                ///< The fetch thread's handle
+   bool running;                   ///< if true, the fetch thread was started
+   bool stop;                      ///< if true, the fetch thread should exit
+   int rc;                         ///< The first error from the fetch thread; no more windows are asked for after one
+   pthread_t thread;               ///< The fetch thread
+   pthread_mutex_t lock;           ///< Guards the windows and the fetch thread's state
+   pthread_cond_t cond;            ///< Signaled when a window is asked for or finished
+};
+
+
+/**
+ * @brief Round down to a multiple of the I/O unit
+ */
+static uint64_t readahead_align_down( struct readahead* ra, uint64_t offset ) {
+   return offset - (offset % ra->io_size);
+}
+
+
+/**
+ * @brief Round up to a multiple of the I/O unit
+ */
+static uint64_t readahead_align_up( struct readahead* ra, uint64_t offset ) {
+   return ((offset + ra->io_size - 1) / ra->io_size) * ra->io_size;
+}
+
+
+// start readahead on a file
+struct readahead* readahead_new( struct UG_state* ug, char const* path, uint64_t io_size, uint64_t max_window ) {
+
+   struct readahead* ra = SG_safe_new( struct readahead );
+   if( ra == NULL ) {
+      return NULL;
+   }
+
+   ra->path = SG_strdup_or_null( path );
+   if( ra->path == NULL ) {
+      SG_safe_delete( ra );
+      return NULL;
+   }
+
+   ra->ug = ug;
+   ra->io_size = std::max( io_size, (uint64_t)1 );
+   ra->max_window = std::max( max_window - (max_window % ra->io_size), ra->io_size );
+   ra->window = std::min( ra->io_size * READAHEAD_INITIAL_UNITS, ra->max_window );
+
+   ra->have_last = false;
+   ra->last_offset = 0;
+   ra->last_len = 0;
+   ra->stride = 0;
+   ra->streak = 0;
+
+   ra->frontier = 0;
+   ra->eof_known = false;
+   ra->eof = 0;
+
+   ra->fh = NULL;
+   ra->running = false;
+   ra->stop = false;
+   ra->rc = 0;
+
+   pthread_mutex_init( &ra->lock, NULL );
+   pthread_cond_init( &ra->cond, NULL );
+
+   return ra;
+}
+
+
+/**
+ * @brief Fetch thread: read windows in offset order as they are asked for, through a handle of its own
+ *
+ * @param[in] arg The readahead state
+ * @return NULL
+ */
+static void* readahead_main( void* arg ) {
+
+   struct readahead* ra = (struct readahead*)arg;
+   struct readahead_window* w = NULL;
+   char* data = NULL;
+   uint64_t data_len = 0;
+   ssize_t nr = 0;
+   int rc = 0;
+
+   ra->fh = UG_open( ra->ug, ra->path, O_RDONLY, &rc );
+   if( rc != 0 ) {
+
+      SG_error("%s: readahead open: %s\n", ra->path, strerror(-rc) );
+      ra->fh = NULL;
+   }
+
+   pthread_mutex_lock( &ra->lock );
+
+   if( rc != 0 ) {
+      ra->rc = rc;
+   }
+
+   while( !ra->stop ) {
+
+      // next window to read
+      w = NULL;
+      for( size_t i = 0; i < ra->windows.size(); i++ ) {
+
+         if( !ra->windows[i]->done && !ra->windows[i]->fetching ) {
+            w = ra->windows[i];
+            break;
+         }
+      }
+
+      if( w == NULL ) {
+         pthread_cond_wait( &ra->cond, &ra->lock );
+         continue;
+      }
+
+      if( ra->rc != 0 ) {
+
+         // can't read; let readers fall back to reading it themselves
+         w->rc = ra->rc;
+         w->done = true;
+         pthread_cond_broadcast( &ra->cond );
+         continue;
+      }
+
+      w->fetching = true;
+
+      pthread_mutex_unlock( &ra->lock );
+
+      data_len = 0;
+      rc = 0;
+
+      data = SG_CALLOC( char, w->len );
+      if( data == NULL ) {
+         rc = -ENOMEM;
+      }
+      else {
+
+         UG_seek( ra->fh, w->offset, SEEK_SET );
+
+         while( data_len < w->len ) {
+
+            nr = UG_read( ra->ug, data + data_len, w->len - data_len, ra->fh );
+            if( nr < 0 ) {
+               rc = nr;
+               break;
+            }
+            if( nr == 0 ) {
+               break;
+            }
+
+            data_len += nr;
+         }
+      }
+
+      pthread_mutex_lock( &ra->lock );
+
+      w->fetching = false;
+
+      if( w->dropped ) {
+
+         // nobody wants it any more
+         SG_safe_free( data );
+         SG_safe_free( w );
+         continue;
+      }
+
+      if( rc != 0 ) {
+
+         SG_error("%s: readahead at %" PRIu64 ": %s\n", ra->path, w->offset, strerror(-rc) );
+         SG_safe_free( data );
+         ra->rc = rc;
+      }
+      else if( data_len < w->len ) {
+
+         // short read means EOF
+         if( !ra->eof_known || w->offset + data_len < ra->eof ) {
+            ra->eof_known = true;
+            ra->eof = w->offset + data_len;
+         }
+      }
+
+      w->data = data;
+      w->data_len = data_len;
+      w->rc = rc;
+      w->done = true;
+
+      pthread_cond_broadcast( &ra->cond );
+   }
+
+   pthread_mutex_unlock( &ra->lock );
+
+   return NULL;
+}
+
+
+/**
+ * @brief Drop a window, and grow or shrink the window size depending on whether it was used
+ *
+ * ra->lock must be held.
+ */
+static void readahead_drop( struct readahead* ra, struct readahead_window* w ) {
+
+   if( w->done && w->rc == 0 ) {
+
+      if( w->used ) {
+         ra->window = std::min( ra->window * 2, ra->max_window );
+      }
+      else {
+         ra->window = std::max( ra->window / 2, ra->io_size );
+      }
+   }
+
+   if( w->fetching ) {
+
+      // the fetch thread frees it
+      w->dropped = true;
+      return;
+   }
+
+   SG_safe_free( w->data );
+   SG_safe_free( w );
+}
+
+
+/**
+ * @brief Ask the fetch thread for a window, starting the thread if need be
+ *
+ * ra->lock must be held.
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int readahead_issue( struct readahead* ra, uint64_t offset, uint64_t len ) {
+
+   int rc = 0;
+   struct readahead_window* w = NULL;
+
+   if( ra->eof_known ) {
+
+      if( offset >= ra->eof ) {
+         return 0;
+      }
+
+      len = std::min( len, readahead_align_up( ra, ra->eof ) - offset );
+   }
+
+   if( len == 0 ) {
+      return 0;
+   }
+
+   if( !ra->running ) {
+
+      rc = pthread_create( &ra->thread, NULL, readahead_main, ra );
+      if( rc != 0 ) {
+
+         SG_error("pthread_create rc = %d\n", rc );
+         ra->rc = -rc;
+         return -rc;
+      }
+
+      ra->running = true;
+   }
+
+   w = SG_CALLOC( struct readahead_window, 1 );
+   if( w == NULL ) {
+      return -ENOMEM;
+   }
+
+   w->offset = offset;
+   w->len = len;
+
+   ra->windows.push_back( w );
+   ra->frontier = offset + len;
+
+   SG_debug("%s: readahead %" PRIu64 " bytes at %" PRIu64 " (window %" PRIu64 ")\n", ra->path, len, offset, ra->window );
+
+   pthread_cond_broadcast( &ra->cond );
+   return 0;
+}
+
+
+// stop readahead and free everything
+void readahead_free( struct readahead* ra ) {
+
+   if( ra == NULL ) {
+      return;
+   }
+
+   if( ra->running ) {
+
+      pthread_mutex_lock( &ra->lock );
+      ra->stop = true;
+      pthread_cond_broadcast( &ra->cond );
+      pthread_mutex_unlock( &ra->lock );
+
+      pthread_join( ra->thread, NULL );
+   }
+
+   if( ra->fh != NULL ) {
+      UG_close( ra->ug, ra->fh );
+   }
+
+   for( size_t i = 0; i < ra->windows.size(); i++ ) {
+      SG_safe_free( ra->windows[i]->data );
+      SG_safe_free( ra->windows[i] );
+   }
+
+   pthread_cond_destroy( &ra->cond );
+   pthread_mutex_destroy( &ra->lock );
+
+   SG_safe_free( ra->path );
+   SG_safe_delete( ra );
+}
+
+
+// get prefetched bytes at offset
+ssize_t readahead_get( struct readahead* ra, uint64_t offset, uint64_t len, char const** data, bool* eof ) {
+
+   struct readahead_window* w = NULL;
+   ssize_t ret = 0;
+
+   *data = NULL;
+   *eof = false;
+
+   pthread_mutex_lock( &ra->lock );
+
+   for( size_t i = 0; i < ra->windows.size(); i++ ) {
+
+      if( ra->windows[i]->offset <= offset && offset < ra->windows[i]->offset + ra->windows[i]->len ) {
+         w = ra->windows[i];
+         break;
+      }
+   }
+
+   if( w != NULL ) {
+
+      // it's coming
+      while( !w->done ) {
+         pthread_cond_wait( &ra->cond, &ra->lock );
+      }
+
+      if( w->rc == 0 ) {
+
+         if( offset < w->offset + w->data_len ) {
+
+            w->used = true;
+            *data = w->data + (offset - w->offset);
+            ret = std::min( len, w->offset + w->data_len - offset );
+         }
+         else {
+
+            // short window
+            *eof = true;
+         }
+      }
+   }
+   else if( ra->eof_known && offset >= ra->eof ) {
+      *eof = true;
+   }
+
+   pthread_mutex_unlock( &ra->lock );
+
+   return ret;
+}
+
+
+// note a range read, and prefetch ahead of the next one
+void readahead_access( struct readahead* ra, uint64_t offset, uint64_t len ) {
+
+   bool sequential = false;
+   bool strided = false;
+   uint64_t delta = 0;
+   uint64_t end = offset + len;
+   uint64_t start = 0;
+   uint64_t limit = 0;
+   uint64_t stop = 0;
+   uint64_t next = 0;
+   std::deque<struct readahead_window*> keep;
+
+   pthread_mutex_lock( &ra->lock );
+
+   if( ra->have_last ) {
+
+      sequential = (offset == ra->last_offset + ra->last_len);
+
+      if( offset > ra->last_offset ) {
+         delta = offset - ra->last_offset;
+      }
+
+      strided = (!sequential && delta > 0 && delta == ra->stride);
+   }
+
+   if( sequential || strided ) {
+      ra->streak++;
+   }
+   else {
+      ra->streak = 0;
+   }
+
+   ra->have_last = true;
+   ra->last_offset = offset;
+   ra->last_len = len;
+   ra->stride = delta;
+
+   // drop windows the ranges have moved past, or all of them if the pattern broke
+   for( size_t i = 0; i < ra->windows.size(); i++ ) {
+
+      struct readahead_window* w = ra->windows[i];
+
+      if( ra->streak == 0 || w->offset + w->len <= offset ) {
+         readahead_drop( ra, w );
+      }
+      else {
+         keep.push_back( w );
+      }
+   }
+
+   ra->windows.swap( keep );
+
+   if( ra->streak == 0 ) {
+      ra->frontier = 0;
+   }
+
+   if( ra->streak == 0 || ra->rc != 0 ) {
+      pthread_mutex_unlock( &ra->lock );
+      return;
+   }
+
+   if( sequential ) {
+
+      // top up once less than half a window is left ahead of the reader
+      start = std::max( ra->frontier, readahead_align_down( ra, end ) );
+      limit = readahead_align_down( ra, end ) + ra->window;
+
+      if( start < limit && start < end + ra->window / 2 ) {
+         readahead_issue( ra, start, limit - start );
+      }
+   }
+   else {
+
+      // fetch the next ranges of the stride, up to a window's worth of the file ahead
+      limit = end + ra->window;
+
+      for( next = offset + ra->stride; next < limit; next += ra->stride ) {
+
+         start = std::max( ra->frontier, readahead_align_down( ra, next ) );
+         stop = readahead_align_up( ra, next + len );
+
+         if( start >= stop ) {
+            continue;
+         }
+
+         if( readahead_issue( ra, start, stop - start ) != 0 || ra->frontier < stop ) {
+
+            // failed, or past EOF
+            break;
+         }
+      }
+   }
+
+   pthread_mutex_unlock( &ra->lock );
+}
@@ -0,0 +1,90 @@
+/*
+   Copyright 2016 The Trustees of Princeton University
+
+   Licensed under the Apache License, Version 2.0 (the "License" );
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/**
+ * @file readahead.h
+ *
+ * @brief Adaptive readahead for a stream of range reads on one file
+ *
+ * The caller reports each range it reads.  Once the ranges form a forward
+ * sequential or strided pattern, a background thread fetches windows of the
+ * file ahead of the next predicted range, through a handle of its own.  The
+ * window doubles each time one is read through, and halves each time one is
+ * dropped without being used (i.e. the prediction was wrong).
+ *
+ * @see readahead.cpp
+ */
+
+#ifndef _SYNDICATE_READAHEAD_H_
+#define _SYNDICATE_READAHEAD_H_
+
+#include <libsyndicate-ug/client.h>
+#include <libsyndicate-ug/core.h>
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <deque>
+
+/**
+ * @brief Readahead state for one file
+ */
+struct readahead;
+
+/**
+ * @brief Start readahead on a file
+ *
+ * No thread is started and no handle is opened until a pattern is seen.
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file
+ * @param[in] io_size Windows are aligned to and sized in multiples of this
+ * @param[in] max_window Largest window, in bytes
+ * @return The readahead state, or NULL if out of memory
+ */
+struct readahead* readahead_new( struct UG_state* ug, char const* path, uint64_t io_size, uint64_t max_window );
+
+/**
+ * @brief Stop readahead, close its handle, and free its windows
+ *
+ * @param[in] ra The readahead state (may be NULL)
+ */
+void readahead_free( struct readahead* ra );
+
+/**
+ * @brief Get prefetched bytes at offset, waiting for a fetch that is under way if it covers offset
+ *
+ * The returned data stays valid until the next call to readahead_access().
+ *
+ * @param[in] ra The readahead state
+ * @param[in] offset Offset of the first byte wanted
+ * @param[in] len Most bytes wanted
+ * @param[out] data Set to the prefetched bytes
+ * @param[out] eof Set to true if offset is known to be at or past EOF
+ * @return The number of bytes at *data (at most len), or 0 if offset was not prefetched
+ */
+ssize_t readahead_get( struct readahead* ra, uint64_t offset, uint64_t len, char const** data, bool* eof );
+
+/**
+ * @brief Record that a range was read, and prefetch ahead of the next predicted range
+ *
+ * @param[in] ra The readahead state
+ * @param[in] offset Offset of the range
+ * @param[in] len Length of the range
+ */
+void readahead_access( struct readahead* ra, uint64_t offset, uint64_t len );
+
+#endif
@@ -26,7 +26,125 @@
 
 #include "syndicate-cat.h"
 
-#define BUF_SIZE 1024 * 1024 * 1024     // 1 GB
+#define BUF_SIZE 1024 * 1024 * 4         // 4 MB in total
+#define PIPELINE_DEPTH 4
+
+/**
+ * @brief How data gets to standard output
+ */
+struct cat_stdout {
+   struct pipeline_local local;    ///< Standard output, for write()
+   bool splice;                    ///< if true, standard output is a pipe, and large buffers are vmspliced into it
+   size_t splice_min;              ///< Smallest buffer to vmsplice; smaller ones are copied with write()
+};
+
+
+/**
+ * @brief Set up the output path for standard output
+ *
+ * If standard output is a pipe, buffers are handed to the kernel with vmsplice instead
+ * of being copied.  The pipe then refers to the buffer's pages until the reader consumes
+ * them, so the pipeline must not refill a spliced buffer until a pipe's worth of data
+ * has been written after it.  Buffers too small to satisfy that are copied instead.
+ * Otherwise, whole buffers are written directly.
+ *
+ * Retirement only counts bytes drained by this pipeline, so splicing must be disabled
+ * if the pipeline will also drain data that never reaches the pipe (e.g. --reread).
+ *
+ * @param[out] out The output path
+ * @param[in] pl The pipeline that will feed it
+ * @param[in] allow_splice if false, never vmsplice
+ */
+static void cat_stdout_init( struct cat_stdout* out, struct pipeline* pl, bool allow_splice ) {
+
+   struct stat sb;
+   long page_size = sysconf( _SC_PAGESIZE );
+   int pipe_size = 0;
+
+   memset( out, 0, sizeof(struct cat_stdout) );
+   out->local.fd = STDOUT_FILENO;
+
+   // NOTE: the depth check also keeps the splice_min division below from dividing by zero
+   if( !allow_splice || fstat( STDOUT_FILENO, &sb ) != 0 || !S_ISFIFO( sb.st_mode ) || pipeline_depth( pl ) <= 2 ) {
+      return;
+   }
+
+   pipe_size = fcntl( STDOUT_FILENO, F_GETPIPE_SZ );
+   if( pipe_size <= 0 ) {
+      return;
+   }
+
+   out->splice_min = (pipe_size + pipeline_depth( pl ) - 3) / (pipeline_depth( pl ) - 2);
+   out->splice_min = ((out->splice_min + page_size - 1) / page_size) * page_size;
+
+   if( out->splice_min > pipeline_buf_len( pl ) ) {
+      return;
+   }
+
+   out->splice = true;
+   pipeline_set_retire( pl, pipe_size );
+
+   SG_debug("vmsplice buffers of at least %zu bytes into a %d-byte pipe\n", out->splice_min, pipe_size );
+}
+
+
+/**
+ * @brief Drain stage to standard output
+ *
+ * @param[in] cls The struct cat_stdout
+ */
+static int cat_drain_stdout( void* cls, char* buf, size_t len ) {
+
+   struct cat_stdout* out = (struct cat_stdout*)cls;
+   struct iovec iov;
+   ssize_t nw = 0;
+
+   if( out->splice && len >= out->splice_min ) {
+
+      iov.iov_base = buf;
+      iov.iov_len = len;
+
+      while( iov.iov_len > 0 ) {
+
+         nw = vmsplice( STDOUT_FILENO, &iov, 1, 0 );
+         if( nw < 0 ) {
+
+            if( errno == EINTR ) {
+               continue;
+            }
+
+            if( iov.iov_len == len && (errno == EINVAL || errno == ENOSYS) ) {
+
+               // can't splice here after all
+               out->splice = false;
+               break;
+            }
+
+            return -errno;
+         }
+
+         iov.iov_base = (char*)iov.iov_base + nw;
+         iov.iov_len -= nw;
+      }
+
+      if( iov.iov_len == 0 ) {
+
+         // the pipe refers to buf until the reader consumes it
+         return PIPELINE_DRAIN_RETIRE;
+      }
+   }
+
+   return pipeline_drain_local( &out->local, buf, len );
+}
+
+/**
+ * @brief Drain stage that discards data (for benchmarking)
+ *
+ * @param[in] cls Unused
+ */
+static int cat_drain_discard( void* cls, char* buf, size_t len ) {
+   return 0;
+}
 
 /**
  * @brief syndicate-cat entry point
@@ -39,8 +157,13 @@ int main( int argc, char** argv ) {
    struct SG_gateway* gateway = NULL;
    char* path = NULL;
    int path_optind = 0;
-   char* buf = NULL;
-   ssize_t nr = 0;
+   struct pipeline* pl = NULL;
+   struct pipeline_ug ugf;
+   struct pipeline_stats stats;
+   struct cat_stdout out;
+   uint64_t buffer_size = 0;
+   uint64_t io_size = 0;
+   int depth = 0;
    int close_rc = 0;
    UG_handle_t* fh = NULL;
 
@@ -55,10 +178,10 @@ int main( int argc, char** argv ) {
    
    memset( &opts, 0, sizeof(tool_opts) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, TOOL_OPT_BUFFER | TOOL_OPT_DEPTH | TOOL_OPT_IO_SIZE | TOOL_OPT_REREAD );
    if( argc < 0 ) {
       
-      usage( argv[0], "file [file...]" );
+      usage( argv[0], "[--buffer SIZE] [--depth N] [--io-size SIZE] [--reread] file [file...]" );
       md_common_usage();
       exit(1);
    }
@@ -77,19 +200,38 @@ int main( int argc, char** argv ) {
    path_optind = SG_gateway_first_arg_optind( gateway );
    if( path_optind == argc ) {
       
-      usage( argv[0], "file [file...]" );
+      usage( argv[0], "[--buffer SIZE] [--depth N] [--io-size SIZE] [--reread] file [file...]" );
+      UG_shutdown( ug );
+      exit(1);
+   }
+
+   // make a small ring of read buffers 
+   depth = (opts.depth > 0 ? opts.depth : PIPELINE_DEPTH);
+   buffer_size = (opts.buffer_size > 0 ? opts.buffer_size : BUF_SIZE);
+   io_size = get_io_size( ug, &opts );
+
+   // stay within --buffer, even if that means fewer buffers (the default grows to fit the I/O unit)
+   if( opts.buffer_size > 0 ) {
+      depth = io_depth( buffer_size, io_size, depth );
+   }
+
+   if( depth < 0 ) {
+
+      fprintf(stderr, "Buffer size %" PRIu64 " is too small for two %" PRIu64 "-byte I/O units\n", buffer_size, io_size );
       UG_shutdown( ug );
       exit(1);
    }
 
-   // make a read buffer (1 MB chunks should be fine) 
-   buf = SG_CALLOC( char, BUF_SIZE );
-   if( buf == NULL ) {
+   pl = pipeline_new( io_align( buffer_size / depth, io_size ), depth );
+   if( pl == NULL ) {
 
       fprintf(stderr, "Out of memory\n");
       exit(1);
    }
 
+   // the --reread pass drains into nothing, which would release spliced buffers early
+   cat_stdout_init( &out, pl, !opts.reread );
+
    if( opts.benchmark ) {
       times = SG_CALLOC( int64_t, argc - path_optind + 1 );
       if( times == NULL ) {
@@ -111,64 +253,44 @@ int main( int argc, char** argv ) {
          goto cat_end;
       }
 
-      // try to read 
+      // stream it out in a single pass 
+      ugf.ug = ug;
+      ugf.fh = fh;
+
       clock_gettime( CLOCK_MONOTONIC, &ts_begin );
-      nr = 0;
-      while( 1 ) {
-          nr = UG_read( ug, buf, BUF_SIZE, fh );
-          if( nr < 0 ) {
-    
-             fprintf(stderr, "%s: read: %s\n", path, strerror(-nr));
-             rc = nr;
-             break;
-          }
-          if( nr == 0 ) {
-
-             // EOF
-             SG_debug("EOF on %s\n", path ); 
-             rc = 0;
-             break;
-          }
-
-          SG_debug("Read %zd bytes\n", nr );
-
-          if( !opts.benchmark ) {
-              fwrite( buf, 1, nr, stdout );
-              fflush( stdout );
-          }
+      if( opts.benchmark ) {
+         rc = pipeline_run( pl, pipeline_fill_ug, &ugf, cat_drain_discard, NULL, &stats );
+      }
+      else {
+         rc = pipeline_run( pl, pipeline_fill_ug, &ugf, cat_drain_stdout, &out, &stats );
       }
-
       clock_gettime( CLOCK_MONOTONIC, &ts_end );
-      
-      // try to read 
-      clock_gettime( CLOCK_MONOTONIC, &ts_begin );
-      nr = 0;
-      while( 1 ) {
-          nr = UG_read( ug, buf, BUF_SIZE, fh );
-          if( nr < 0 ) {
-    
-             fprintf(stderr, "%s: read: %s\n", path, strerror(-nr));
-             rc = nr;
-             break;
-          }
-          if( nr == 0 ) {
-
-             // EOF
-             SG_debug("EOF on %s\n", path ); 
-             rc = 0;
-             break;
-          }
-
-          SG_debug("Read %zd bytes\n", nr );
-
-          if( !opts.benchmark ) {
-              fwrite( buf, 1, nr, stdout );
-              fflush( stdout );
-          }
+
+      if( rc == 0 && opts.reread ) {
+
+         // read it again from the (now warm) cache, and time that instead
+         off_t pos = UG_seek( fh, 0, SEEK_SET );
+         if( pos != 0 ) {
+
+            rc = (pos < 0 ? (int)pos : -EIO);
+            fprintf(stderr, "%s: seek: %s\n", path, strerror(-rc));
+         }
+         else {
+
+            clock_gettime( CLOCK_MONOTONIC, &ts_begin );
+            rc = pipeline_run( pl, pipeline_fill_ug, &ugf, cat_drain_discard, NULL, &stats );
+            clock_gettime( CLOCK_MONOTONIC, &ts_end );
+         }
       }
 
-      clock_gettime( CLOCK_MONOTONIC, &ts_end );
+      if( stats.fill_rc < 0 ) {
+         fprintf(stderr, "%s: read: %s\n", path, strerror(-stats.fill_rc));
+      }
+      if( stats.drain_rc < 0 ) {
+         fprintf(stderr, "%s: write: %s\n", path, strerror(-stats.drain_rc));
+      }
 
+      SG_debug("Read %" PRIu64 " bytes from %s\n", stats.bytes, path );
 
       // close up 
       close_rc = UG_close( ug, fh );
@@ -188,7 +310,7 @@ int main( int argc, char** argv ) {
    }
 
 cat_end:
-   SG_safe_free(buf );
+   pipeline_free( pl );
    UG_shutdown( ug );
 
    if( times != NULL ) {
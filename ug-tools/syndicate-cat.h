@@ -39,6 +39,21 @@
  * @section description DESCRIPTION
  * Concatenate FILE(s) in syndicate and print on the standard output.
  *
+ * @section options OPTIONS
+ * --buffer SIZE\n
+ * Use at most SIZE bytes of read buffers (K, M and G suffixes are allowed).  Each buffer holds at least one I/O unit (see --io-size), so fewer buffers than --depth are used if SIZE is too small for them, and SIZE must hold at least two I/O units.  The default is 4M, or one I/O unit per buffer if that is larger.
+ *
+ * --depth N\n
+ * Split the read buffers into N buffers (default 4).  The next buffer is fetched while the current one is written out.
+ *
+ * --reread\n
+ * After each FILE is printed, read it again and discard the data.  With -B, the re-read is timed instead of the first read, to measure warm-cache reads.  Data is always copied to standard output with --reread.
+ *
+ * --io-size SIZE\n
+ * Read from Syndicate in whole multiples of SIZE bytes (K, M and G suffixes are allowed).  Buffers are rounded down to a multiple of SIZE.  The default is the volume's block size.
+ *
+ * Data is written to standard output directly, a whole buffer at a time.  If standard output is a pipe, large buffers are moved into it with vmsplice(2) instead of being copied, and are not reused until the pipe has taken in a pipe's worth of data after them.  A reader that splices the data onward (e.g. with tee(2)) instead of reading it should not be used with a pipe from syndicate-cat.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -67,6 +82,10 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <fcntl.h>
+#include <sys/uio.h>
+
 #include "common.h"
+#include "pipeline.h"
 
 #endif
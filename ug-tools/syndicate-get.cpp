@@ -27,6 +27,1216 @@
 #include "syndicate-get.h"
 
 #define BUF_SIZE 1024 * 1024 * 10
+#define PIPELINE_DEPTH 2
+#define JOURNAL_SUFFIX ".sg-journal"
+
+/**
+ * @brief A byte range of the file being fetched by one worker
+ *
+ * Bytes in [offset, end) have not been claimed yet.  Another worker may
+ * steal the tail of the range by lowering end.
+ */
+struct get_range {
+   off_t offset;                   ///< Next unclaimed byte
+   off_t end;                      ///< End of the range (exclusive)
+};
+
+/**
+ * @brief State shared by the workers fetching one file in parallel
+ */
+struct get_ranged_ctx {
+   struct UG_state* ug;            ///< State of UG, shared by all workers
+   char const* path;               ///< Path to the file in the volume
+   char const* file_path;          ///< Path to the local file
+   int fd;                         ///< Local file descriptor, written with pwrite
+   off_t block_size;               ///< I/O unit (normally the volume block size); ranges are split on its boundaries
+   size_t chunk_len;               ///< Bytes to fetch per UG_read (a multiple of block_size)
+   struct get_range* ranges;       ///< One range per worker
+   int num_ranges;                 ///< Number of workers
+   struct journal_extent* todo;    ///< Ranges of the file to fetch, handed to workers in order before any stealing
+   size_t num_todo;                ///< Number of ranges in todo
+   size_t next_todo;               ///< Index of the next range in todo to hand out
+   struct journal* journal;        ///< If not NULL, record each chunk here once it is durable (--resume)
+   bool sparse;                    ///< If true, leave all-zero blocks out of the local file (--sparse)
+   bool punch;                     ///< If true, the local file may already hold data, so zero blocks are punched out
+   int next_worker;                ///< Index of the next worker to start
+   int rc;                         ///< 0, or the first error encountered
+   pthread_mutex_t lock;           ///< Lock protecting the above
+};
+
+
+/**
+ * @brief A directory or file found in a recursive fetch (-r)
+ */
+struct get_tree_item {
+   char* path;                     ///< Path in the volume
+   char* file_path;                ///< Local path
+};
+
+/**
+ * @brief State shared by the workers fetching a directory tree (-r)
+ */
+struct get_tree {
+   struct UG_state* ug;            ///< State of UG, shared by all workers
+   struct tool_opts* opts;         ///< Tool options
+   uint64_t io_size;               ///< I/O unit to size and align reads to
+   size_t buf_len;                 ///< Bytes per transfer buffer
+   int depth;                      ///< Transfer buffers per worker
+   std::deque<struct get_tree_item> dirs;      ///< Directories to list, in the order they were found
+   std::deque<struct get_tree_item> files;     ///< Files to fetch, in the order they were found
+   std::vector<int64_t> times;     ///< Milliseconds each fetched file took (-B)
+   int listing;                    ///< Number of directories being listed right now
+   bool failed;                    ///< if true, something failed and no more work will be handed out
+   pthread_mutex_t lock;           ///< Lock protecting the above
+   pthread_cond_t cond;            ///< Signaled whenever a listing finishes, or a worker stops
+};
+
+/**
+ * @brief Sparse drain state: where the next buffer goes in the local file
+ */
+struct get_sparse {
+   int fd;                         ///< Local file descriptor, written with pwrite
+   off_t offset;                   ///< Offset of the next buffer
+   off_t block_size;               ///< Zero blocks of this size (aligned in the file) are left out
+   bool punch;                     ///< If true, punch zero blocks out instead of just skipping them
+};
+
+
+/**
+ * @brief Write all of a buffer to a local file at an offset
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int get_pwrite( int fd, char const* buf, size_t len, off_t offset ) {
+
+   ssize_t nw = 0;
+
+   while( len > 0 ) {
+
+      nw = pwrite( fd, buf, len, offset );
+      if( nw < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         return -errno;
+      }
+
+      buf += nw;
+      len -= nw;
+      offset += nw;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Write a buffer to a local file at an offset, leaving out its all-zero blocks (--sparse)
+ *
+ * Blocks are block_size bytes, aligned in the file.  Zero blocks are not written, so in a
+ * file that was just laid out with ftruncate they stay holes.  If punch is set, the file may
+ * already have data there, so zero blocks are punched out instead, or written if the
+ * file system can't punch holes.  Adjacent blocks are written or punched together.
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int get_pwrite_sparse( int fd, char const* buf, size_t len, off_t offset, off_t block_size, bool punch ) {
+
+   int rc = 0;
+   size_t pos = 0;
+   size_t run = 0;
+   size_t block_len = 0;
+   bool zero = false;
+
+   while( pos < len ) {
+
+      // the run starts with the block at pos, which may be partial if offset is unaligned
+      run = std::min( (size_t)(block_size - (offset + pos) % block_size), len - pos );
+      zero = buf_is_zero( buf + pos, run );
+
+      // extend it over the following blocks of the same kind
+      while( pos + run < len ) {
+
+         block_len = std::min( (size_t)block_size, len - pos - run );
+         if( buf_is_zero( buf + pos + run, block_len ) != zero ) {
+            break;
+         }
+
+         run += block_len;
+      }
+
+      if( !zero ) {
+         rc = get_pwrite( fd, buf + pos, run, offset + pos );
+      }
+      else if( punch && fallocate( fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset + pos, run ) != 0 ) {
+
+         rc = -errno;
+         if( rc == -EOPNOTSUPP ) {
+
+            // no hole punching here; the zeros have to be written
+            rc = get_pwrite( fd, buf + pos, run, offset + pos );
+         }
+      }
+
+      if( rc != 0 ) {
+         return rc;
+      }
+
+      pos += run;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Drain to a local file, leaving out all-zero blocks (--sparse)
+ *
+ * The file's size must be set with ftruncate once the pipeline is done, in case it ends in zeros.
+ */
+static int get_drain_sparse( void* cls, char* buf, size_t len ) {
+
+   struct get_sparse* sparse = (struct get_sparse*)cls;
+   int rc = 0;
+
+   rc = get_pwrite_sparse( sparse->fd, buf, len, sparse->offset, sparse->block_size, sparse->punch );
+   if( rc != 0 ) {
+      return rc;
+   }
+
+   sparse->offset += len;
+   return 0;
+}
+
+
+/**
+ * @brief Give an idle worker the tail half of the range with the most unclaimed bytes
+ *
+ * The split point is block-aligned, so a range is only split if it has at least
+ * two unclaimed blocks.  ctx->lock must be held.
+ *
+ * @param[in] ctx The fetch state
+ * @param[in] idx The idle worker's range
+ * @retval true The idle worker has a new range
+ * @retval false There is no range worth splitting
+ */
+static bool get_ranged_steal( struct get_ranged_ctx* ctx, int idx ) {
+
+   struct get_range* victim = NULL;
+   off_t remaining = 0;
+   off_t split = 0;
+
+   for( int i = 0; i < ctx->num_ranges; i++ ) {
+
+      if( ctx->ranges[i].end - ctx->ranges[i].offset > remaining ) {
+         victim = &ctx->ranges[i];
+         remaining = victim->end - victim->offset;
+      }
+   }
+
+   if( victim == NULL || remaining < 2 * ctx->block_size ) {
+      return false;
+   }
+
+   split = victim->offset + remaining / 2;
+   split -= split % ctx->block_size;
+
+   if( split <= victim->offset ) {
+      return false;
+   }
+
+   ctx->ranges[idx].offset = split;
+   ctx->ranges[idx].end = victim->end;
+   victim->end = split;
+
+   return true;
+}
+
+
+/**
+ * @brief Give an idle worker the next range that nobody has started, or else steal one
+ *
+ * ctx->lock must be held.
+ *
+ * @param[in] ctx The fetch state
+ * @param[in] idx The idle worker's range
+ * @retval true The idle worker has a new range
+ * @retval false There is nothing left to fetch
+ */
+static bool get_ranged_next( struct get_ranged_ctx* ctx, int idx ) {
+
+   while( ctx->next_todo < ctx->num_todo ) {
+
+      ctx->ranges[idx].offset = ctx->todo[ ctx->next_todo ].offset;
+      ctx->ranges[idx].end = ctx->todo[ ctx->next_todo ].offset + ctx->todo[ ctx->next_todo ].len;
+      ctx->next_todo++;
+
+      if( ctx->ranges[idx].offset < ctx->ranges[idx].end ) {
+         return true;
+      }
+   }
+
+   return get_ranged_steal( ctx, idx );
+}
+
+
+/**
+ * @brief Ranged fetch worker: fetch chunks of this worker's range with its own handle and
+ * pwrite them into place, then take unstarted ranges or steal from other workers' ranges until nothing is left.
+ *
+ * @param[in] arg The get_ranged_ctx
+ * @return NULL
+ */
+static void* get_ranged_worker( void* arg ) {
+
+   struct get_ranged_ctx* ctx = (struct get_ranged_ctx*)arg;
+   struct get_range* range = NULL;
+   UG_handle_t* fh = NULL;
+   struct pipeline_ug ugf;
+   char* buf = NULL;
+   int idx = 0;
+   int rc = 0;
+   off_t pos = -1;
+   off_t offset = 0;
+   size_t len = 0;
+   ssize_t nr = 0;
+
+   pthread_mutex_lock( &ctx->lock );
+   idx = ctx->next_worker;
+   ctx->next_worker++;
+   range = &ctx->ranges[idx];
+   pthread_mutex_unlock( &ctx->lock );
+
+   buf = SG_CALLOC( char, ctx->chunk_len );
+   if( buf == NULL ) {
+      rc = -ENOMEM;
+      goto get_ranged_worker_end;
+   }
+
+   fh = UG_open( ctx->ug, ctx->path, O_RDONLY, &rc );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to open '%s': %d %s\n", ctx->path, rc, strerror( abs(rc) ) );
+      goto get_ranged_worker_end;
+   }
+
+   ugf.ug = ctx->ug;
+   ugf.fh = fh;
+
+   while( 1 ) {
+
+      // claim the next chunk 
+      pthread_mutex_lock( &ctx->lock );
+
+      if( ctx->rc != 0 ) {
+         pthread_mutex_unlock( &ctx->lock );
+         break;
+      }
+
+      if( range->offset >= range->end && !get_ranged_next( ctx, idx ) ) {
+         pthread_mutex_unlock( &ctx->lock );
+         break;
+      }
+
+      offset = range->offset;
+      len = std::min( (off_t)ctx->chunk_len, range->end - offset );
+      range->offset += len;
+
+      pthread_mutex_unlock( &ctx->lock );
+
+      if( pos != offset ) {
+         pos = UG_seek( fh, offset, SEEK_SET );
+         if( pos != offset ) {
+            rc = (pos < 0 ? (int)pos : -EIO);
+            fprintf(stderr, "Failed to seek '%s' to %jd: %s\n", ctx->path, (intmax_t)offset, strerror(abs(rc)));
+            break;
+         }
+      }
+
+      nr = pipeline_fill_ug( &ugf, buf, len );
+      if( nr < 0 ) {
+         rc = nr;
+         fprintf(stderr, "Failed to read '%s': %s\n", ctx->path, strerror(abs(rc)));
+         break;
+      }
+
+      if( nr > 0 ) {
+
+         if( ctx->sparse ) {
+            rc = get_pwrite_sparse( ctx->fd, buf, nr, offset, ctx->block_size, ctx->punch );
+         }
+         else {
+            rc = get_pwrite( ctx->fd, buf, nr, offset );
+         }
+
+         if( rc != 0 ) {
+            fprintf(stderr, "Failed to write '%s': %d %s\n", ctx->file_path, rc, strerror(abs(rc)));
+            break;
+         }
+      }
+
+      pos += nr;
+
+      if( ctx->journal != NULL && nr > 0 ) {
+
+         // the chunk must be on disk before the journal says it is
+         if( fdatasync( ctx->fd ) != 0 ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to sync '%s': %s\n", ctx->file_path, strerror(-rc));
+            break;
+         }
+
+         rc = journal_append( ctx->journal, offset, nr );
+         if( rc != 0 ) {
+            break;
+         }
+      }
+
+      if( (size_t)nr < len ) {
+
+         // file shrank out from under us 
+         rc = -ENODATA;
+         fprintf(stderr, "Short read on '%s' at %jd\n", ctx->path, (intmax_t)(offset + nr) );
+         break;
+      }
+   }
+
+get_ranged_worker_end:
+
+   if( fh != NULL ) {
+      UG_close( ctx->ug, fh );
+   }
+
+   SG_safe_free( buf );
+
+   if( rc != 0 ) {
+      pthread_mutex_lock( &ctx->lock );
+      if( ctx->rc == 0 ) {
+         ctx->rc = rc;
+      }
+      pthread_mutex_unlock( &ctx->lock );
+   }
+
+   return NULL;
+}
+
+
+/**
+ * @brief Fetch ranges of a file with several workers, each reading a block-aligned byte range with its own handle
+ *
+ * Workers take the ranges in todo in order.  Once they are all taken, idle workers split
+ * the range with the most unclaimed bytes, so the file is divided up as workers come
+ * online, and one slow range does not hold up the file.
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] file_path Path to the local file
+ * @param[in] fd Local file descriptor
+ * @param[in] size Size of the file
+ * @param[in] num_workers Number of workers to use
+ * @param[in] io_size I/O unit to size and align reads to
+ * @param[in] todo The ranges to fetch (normally the whole file)
+ * @param[in] journal If not NULL, the journal to record fetched chunks in
+ * @param[in] sparse If true, leave all-zero blocks out of the local file
+ * @param[in] punch If true (with sparse), punch zero blocks out of the local file, since it may already have data there
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int get_file_ranged( struct UG_state* ug, char const* path, char const* file_path, int fd, off_t size, int num_workers, uint64_t io_size, std::vector<struct journal_extent>& todo, struct journal* journal, bool sparse, bool punch ) {
+
+   int rc = 0;
+   struct get_ranged_ctx ctx;
+   pthread_t* threads = NULL;
+
+   memset( &ctx, 0, sizeof(struct get_ranged_ctx) );
+
+   ctx.ug = ug;
+   ctx.path = path;
+   ctx.file_path = file_path;
+   ctx.fd = fd;
+   ctx.block_size = io_size;
+   ctx.chunk_len = io_align( BUF_SIZE, io_size );
+   ctx.num_ranges = num_workers;
+   ctx.todo = (todo.size() > 0 ? &todo[0] : NULL);
+   ctx.num_todo = todo.size();
+   ctx.journal = journal;
+   ctx.sparse = sparse;
+   ctx.punch = punch;
+
+   ctx.ranges = SG_CALLOC( struct get_range, num_workers );
+   threads = SG_CALLOC( pthread_t, num_workers );
+   if( ctx.ranges == NULL || threads == NULL ) {
+      SG_safe_free( ctx.ranges );
+      SG_safe_free( threads );
+      return -ENOMEM;
+   }
+
+   // lay out the local file, so workers can fill it in any order (and skipped zero blocks are holes)
+   rc = ftruncate( fd, size );
+   if( rc != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to truncate '%s': %s\n", file_path, strerror(-rc));
+      SG_safe_free( ctx.ranges );
+      SG_safe_free( threads );
+      return rc;
+   }
+
+   // workers start idle, and take ranges from todo
+   pthread_mutex_init( &ctx.lock, NULL );
+
+   rc = start_threads( threads, num_workers, get_ranged_worker, &ctx );
+   if( rc < 0 ) {
+      fprintf(stderr, "Failed to start fetch threads: %s\n", strerror(-rc));
+   }
+   else {
+      join_threads( threads, rc );
+      rc = ctx.rc;
+   }
+
+   pthread_mutex_destroy( &ctx.lock );
+   SG_safe_free( ctx.ranges );
+   SG_safe_free( threads );
+
+   return rc;
+}
+
+/**
+ * @brief Fetch a file, or the parts of it that an interrupted fetch did not finish (--resume)
+ *
+ * A journal next to the local file records the remote file's ID, version and size, and each
+ * chunk once it is durable.  If the journal matches the remote file, only the chunks it does
+ * not list are fetched.  Otherwise the whole file is fetched again.  The journal is removed
+ * once the local file is complete and synced.
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] file_path Path to the local file
+ * @param[in] num_workers Number of workers to use
+ * @param[in] io_size I/O unit to size and align reads to
+ * @param[in] sparse If true, leave all-zero blocks out of the local file
+ * @param[out] total Size of the file
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int get_file_resume( struct UG_state* ug, char const* path, char const* file_path, int num_workers, uint64_t io_size, bool sparse, ssize_t* total ) {
+
+   int rc = 0;
+   int fd = -1;
+   char* journal_path = NULL;
+   char* header = NULL;
+   struct journal* journal = NULL;
+   struct md_entry ent;
+   std::vector<struct journal_extent> todo;
+   uint64_t done = 0;
+   size_t header_len = 0;
+
+   rc = UG_stat_raw( ug, path, &ent );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to stat '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+      return rc;
+   }
+
+   // identifies this version of the remote file
+   header_len = strlen(path) + 128;
+   header = SG_CALLOC( char, header_len );
+   journal_path = SG_CALLOC( char, strlen(file_path) + strlen(JOURNAL_SUFFIX) + 1 );
+   if( header == NULL || journal_path == NULL ) {
+      md_entry_free( &ent );
+      SG_safe_free( header );
+      SG_safe_free( journal_path );
+      return -ENOMEM;
+   }
+
+   snprintf( header, header_len, "syndicate-get %s %" PRIX64 " %" PRId64 " %" PRId64 " %jd", path, ent.file_id, ent.version, ent.write_nonce, (intmax_t)ent.size );
+   sprintf( journal_path, "%s%s", file_path, JOURNAL_SUFFIX );
+
+   *total = ent.size;
+   md_entry_free( &ent );
+
+   // only a local file with a journal is a partial fetch; don't clobber anything else
+   if( access( journal_path, F_OK ) == 0 ) {
+
+      fd = open( file_path, O_WRONLY );
+      if( fd < 0 ) {
+
+         if( errno != ENOENT ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
+            goto get_file_resume_end;
+         }
+
+         // the partial file is gone (or was never created), so the journal is meaningless
+         unlink( journal_path );
+      }
+   }
+
+   // the journal is created before the local file, so the local file never exists without one
+   rc = journal_open( journal_path, header, &journal );
+   if( rc < 0 ) {
+      goto get_file_resume_end;
+   }
+
+   if( fd < 0 ) {
+
+      fd = open( file_path, O_CREAT | O_EXCL | O_WRONLY, 0600 );
+      if( fd < 0 ) {
+         rc = -errno;
+         fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
+
+         // not ours to resume
+         journal_remove( journal );
+         journal = NULL;
+         goto get_file_resume_end;
+      }
+   }
+
+   // fetch what's missing 
+   journal_missing( journal, *total, &todo );
+
+   for( size_t i = 0; i < todo.size(); i++ ) {
+      done += todo[i].len;
+   }
+
+   done = *total - done;
+   if( rc == JOURNAL_RESUMED ) {
+      SG_debug("Resuming '%s': %" PRIu64 " of %zd bytes already fetched, %zu ranges left\n", path, done, *total, todo.size() );
+   }
+
+   // an interrupted run may have left data in the missing ranges, so zero blocks are punched
+   rc = get_file_ranged( ug, path, file_path, fd, *total, num_workers, io_size, todo, journal, sparse, true );
+   if( rc != 0 ) {
+      goto get_file_resume_end;
+   }
+
+   if( fsync( fd ) != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to sync '%s': %s\n", file_path, strerror(-rc));
+      goto get_file_resume_end;
+   }
+
+   // done; nothing to resume
+   rc = journal_remove( journal );
+   journal = NULL;
+
+get_file_resume_end:
+
+   if( fd >= 0 && close( fd ) != 0 && rc == 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to close '%s': %s\n", file_path, strerror(-rc));
+   }
+
+   journal_free( journal );
+   SG_safe_free( header );
+   SG_safe_free( journal_path );
+
+   return rc;
+}
+
+
+/**
+ * @brief Bring an existing local copy of a file up to date, fetching only the blocks that differ (--update)
+ *
+ * The local copy is hashed block by block.  The remote file's block hashes come from
+ * its user.syndicate.blockhash xattr if they describe it as it is now, and are computed
+ * by reading it otherwise.  The differing blocks are fetched as with -j, and the local
+ * copy is truncated to the remote file's size.  A missing local copy is fetched whole.
+ *
+ * @param[in] ug The UG state
+ * @param[in] path Path to the file in the volume
+ * @param[in] file_path Path to the local file
+ * @param[in] num_workers Number of workers to fetch with
+ * @param[in] io_size I/O unit; blocks of this size are compared
+ * @param[in] sparse If true, punch the fetched blocks that are all zeros out of the local file
+ * @param[out] total Size of the file
+ * @param[out] fetched Bytes fetched
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int get_file_update( struct UG_state* ug, char const* path, char const* file_path, int num_workers, uint64_t io_size, bool sparse, ssize_t* total, uint64_t* fetched ) {
+
+   int rc = 0;
+   int fd = -1;
+   int hash_threads = std::max( (int)sysconf( _SC_NPROCESSORS_ONLN ), 1 );
+   struct md_entry ent;
+   struct stat sb;
+   char* header = NULL;
+   unsigned char* local_hashes = NULL;
+   unsigned char* remote_hashes = NULL;
+   uint64_t size = 0;
+   uint64_t local_size = 0;
+   uint64_t local_blocks = 0;
+   uint64_t remote_blocks = 0;
+   uint64_t run_end = 0;
+   struct journal_extent ext;
+   std::vector<struct journal_extent> todo;
+
+   *fetched = 0;
+
+   rc = UG_stat_raw( ug, path, &ent );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to stat '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+      return rc;
+   }
+
+   size = ent.size;
+   *total = ent.size;
+   header = blockhash_header( &ent, io_size );
+
+   md_entry_free( &ent );
+
+   if( header == NULL ) {
+      return -ENOMEM;
+   }
+
+   fd = open( file_path, O_RDWR | O_CREAT, 0600 );
+   if( fd < 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
+      goto get_file_update_end;
+   }
+
+   if( fstat( fd, &sb ) != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to stat '%s': %s\n", file_path, strerror(-rc));
+      goto get_file_update_end;
+   }
+
+   // bytes past the remote file's end don't matter
+   local_size = std::min( (uint64_t)sb.st_size, size );
+   local_blocks = blockhash_count( local_size, io_size );
+   remote_blocks = blockhash_count( size, io_size );
+
+   local_hashes = SG_CALLOC( unsigned char, local_blocks * BLOCKHASH_LEN + 1 );
+   remote_hashes = SG_CALLOC( unsigned char, remote_blocks * BLOCKHASH_LEN + 1 );
+   if( local_hashes == NULL || remote_hashes == NULL ) {
+      rc = -ENOMEM;
+      goto get_file_update_end;
+   }
+
+   if( local_blocks > 0 ) {
+
+      rc = blockhash_local( fd, local_size, io_size, hash_threads, local_hashes );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to hash '%s': %s\n", file_path, strerror(abs(rc)));
+         goto get_file_update_end;
+      }
+
+      // published by whoever wrote the file last, if nothing has written to it since
+      rc = blockhash_xattr_load( ug, path, header, remote_blocks, remote_hashes );
+      if( rc != 0 ) {
+
+         rc = blockhash_remote( ug, path, size, io_size, hash_threads, remote_hashes );
+         if( rc != 0 ) {
+            fprintf(stderr, "Failed to hash '%s': %s\n", path, strerror(abs(rc)));
+            goto get_file_update_end;
+         }
+      }
+   }
+
+   // fetch each run of blocks that differ
+   for( uint64_t b = 0; b < remote_blocks; b = run_end ) {
+
+      run_end = b + 1;
+
+      if( b < local_blocks && memcmp( local_hashes + b * BLOCKHASH_LEN, remote_hashes + b * BLOCKHASH_LEN, BLOCKHASH_LEN ) == 0 ) {
+         continue;
+      }
+
+      while( run_end < remote_blocks && !(run_end < local_blocks && memcmp( local_hashes + run_end * BLOCKHASH_LEN, remote_hashes + run_end * BLOCKHASH_LEN, BLOCKHASH_LEN ) == 0) ) {
+         run_end++;
+      }
+
+      ext.offset = b * io_size;
+      ext.len = std::min( run_end * io_size, size ) - ext.offset;
+
+      todo.push_back( ext );
+      *fetched += ext.len;
+   }
+
+   SG_debug("'%s': %" PRIu64 " of %" PRIu64 " bytes differ, in %zu ranges\n", file_path, *fetched, size, todo.size() );
+
+   // also truncates to the remote size
+   rc = get_file_ranged( ug, path, file_path, fd, size, num_workers, io_size, todo, NULL, sparse, true );
+   if( rc != 0 ) {
+      goto get_file_update_end;
+   }
+
+   if( fsync( fd ) != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to sync '%s': %s\n", file_path, strerror(-rc));
+   }
+
+get_file_update_end:
+
+   if( fd >= 0 && close( fd ) != 0 && rc == 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to close '%s': %s\n", file_path, strerror(-rc));
+   }
+
+   SG_safe_free( header );
+   SG_safe_free( local_hashes );
+   SG_safe_free( remote_hashes );
+
+   return rc;
+}
+
+
+/**
+ * @brief Fetch one file, whichever way the options say
+ *
+ * @param[in] ug The UG state
+ * @param[in] opts Tool options
+ * @param[in] path Path to the file in the volume
+ * @param[in] file_path Path to the local file
+ * @param[in] num_workers Number of workers to fetch the file with (with more than one, or --resume or --update, byte ranges are fetched in parallel)
+ * @param[in] io_size I/O unit to size and align reads to
+ * @param[in] pl Transfer buffers, for fetching with one worker
+ * @param[out] total Size of the file
+ * @param[out] stats Per-stage timings, when fetched through pl
+ * @param[out] ts_begin When the fetch started
+ * @param[out] ts_end When the fetch finished
+ * @retval 0 Success
+ * @retval 1 Failure (the reason is printed to stderr)
+ */
+static int get_file( struct UG_state* ug, struct tool_opts* opts, char const* path, char const* file_path, int num_workers, uint64_t io_size, struct pipeline* pl,
+                     ssize_t* total, struct pipeline_stats* stats, struct timespec* ts_begin, struct timespec* ts_end ) {
+
+   int rc = 0;
+   int fd = 0;
+   UG_handle_t* fh = NULL;
+   struct md_entry ent;
+   struct pipeline_ug ugf;
+   struct pipeline_local local;
+   struct get_sparse sparse;
+   std::vector<struct journal_extent> whole;
+   uint64_t fetched = 0;
+
+   *total = 0;
+   memset( stats, 0, sizeof(struct pipeline_stats) );
+
+   if( !opts->resume && !opts->update ) {
+
+      // open the file...
+      fd = open( file_path, O_CREAT | O_EXCL | O_WRONLY, 0600 );
+      if( fd < 0 ) {
+         rc = -errno;
+         fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
+         return 1;
+      }
+   }
+
+   if( opts->update ) {
+
+      // fetch only what changed
+      clock_gettime( CLOCK_MONOTONIC, ts_begin );
+
+      rc = get_file_update( ug, path, file_path, std::max( num_workers, 1 ), io_size, opts->sparse, total, &fetched );
+      if( rc != 0 ) {
+         return 1;
+      }
+
+      clock_gettime( CLOCK_MONOTONIC, ts_end );
+
+      SG_debug("Fetched %" PRIu64 " of %zd bytes for %s\n", fetched, *total, path );
+   }
+   else if( opts->resume ) {
+
+      // fetch whatever an earlier run left out
+      clock_gettime( CLOCK_MONOTONIC, ts_begin );
+
+      rc = get_file_resume( ug, path, file_path, std::max( num_workers, 1 ), io_size, opts->sparse, total );
+      if( rc != 0 ) {
+         return 1;
+      }
+
+      clock_gettime( CLOCK_MONOTONIC, ts_end );
+   }
+   else if( num_workers > 1 ) {
+
+      // fetch block-aligned ranges in parallel
+      clock_gettime( CLOCK_MONOTONIC, ts_begin );
+
+      rc = UG_stat_raw( ug, path, &ent );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to stat '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+         close( fd );
+         return 1;
+      }
+
+      *total = ent.size;
+      md_entry_free( &ent );
+
+      whole.resize( 1 );
+      whole[0].offset = 0;
+      whole[0].len = *total;
+
+      rc = get_file_ranged( ug, path, file_path, fd, *total, num_workers, io_size, whole, NULL, opts->sparse, false );
+      close( fd );
+
+      if( rc != 0 ) {
+         return 1;
+      }
+
+      clock_gettime( CLOCK_MONOTONIC, ts_end );
+   }
+   else {
+
+      // try to open
+      fh = UG_open( ug, path, O_RDONLY, &rc );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to open '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+         close( fd );
+         return 1;
+      }
+
+      // fetch the next buffer while the current one is written
+      ugf.ug = ug;
+      ugf.fh = fh;
+      memset( &local, 0, sizeof(struct pipeline_local) );
+      local.fd = fd;
+
+      memset( &sparse, 0, sizeof(struct get_sparse) );
+      sparse.fd = fd;
+      sparse.block_size = io_size;
+
+      clock_gettime( CLOCK_MONOTONIC, ts_begin );
+
+      if( opts->sparse ) {
+
+         // the file is new, so zero blocks only need to be skipped
+         rc = pipeline_run( pl, pipeline_fill_ug, &ugf, get_drain_sparse, &sparse, stats );
+
+         // trailing zero blocks were never written
+         if( rc == 0 && ftruncate( fd, stats->bytes ) != 0 ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to truncate '%s': %s\n", file_path, strerror(-rc));
+         }
+      }
+      else {
+         rc = pipeline_run( pl, pipeline_fill_ug, &ugf, pipeline_drain_local, &local, stats );
+      }
+
+      close( fd );
+
+      if( stats->fill_rc < 0 ) {
+         fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(abs(stats->fill_rc)));
+      }
+      if( stats->drain_rc < 0 ) {
+         fprintf(stderr, "Failed to write '%s': %d %s\n", file_path, stats->drain_rc, strerror(abs(stats->drain_rc)));
+      }
+
+      if( rc < 0 ) {
+         UG_close( ug, fh );
+         return 1;
+      }
+
+      *total = stats->bytes;
+
+      clock_gettime( CLOCK_MONOTONIC, ts_end );
+
+      // close
+      rc = UG_close( ug, fh );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to close '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+         return 1;
+      }
+   }
+
+   SG_debug("Read %zd bytes for %s\n", *total, path );
+   return 0;
+}
+
+
+/**
+ * @brief Join a directory path and a name
+ *
+ * @return The joined path (to be freed), or NULL if out of memory
+ */
+static char* get_path_join( char const* dir, char const* name ) {
+
+   size_t len = strlen(dir);
+   char* ret = SG_CALLOC( char, len + strlen(name) + 2 );
+
+   if( ret == NULL ) {
+      return NULL;
+   }
+
+   if( len > 0 && dir[len-1] == '/' ) {
+      sprintf( ret, "%s%s", dir, name );
+   }
+   else {
+      sprintf( ret, "%s/%s", dir, name );
+   }
+
+   return ret;
+}
+
+
+/**
+ * @brief Free the paths of a directory or file found in a recursive fetch
+ */
+static void get_tree_item_free( struct get_tree_item* item ) {
+
+   SG_safe_free( item->path );
+   SG_safe_free( item->file_path );
+}
+
+
+/**
+ * @brief List one directory of a recursive fetch (-r), creating the local copies of its subdirectories
+ *
+ * ctx->lock must not be held.
+ *
+ * @param[in] ctx The fetch state
+ * @param[in] dir The directory to list
+ * @param[out] dirs Its subdirectories, to be listed next
+ * @param[out] files Its files, to be fetched
+ * @retval 0 Success
+ * @retval -errno Failure (the reason is printed to stderr)
+ */
+static int get_tree_list( struct get_tree* ctx, struct get_tree_item* dir, std::vector<struct get_tree_item>* dirs, std::vector<struct get_tree_item>* files ) {
+
+   int rc = 0;
+   UG_handle_t* dirh = NULL;
+   struct md_entry** dirents = NULL;
+   struct get_tree_item item;
+
+   dirh = UG_opendir( ctx->ug, dir->path, &rc );
+   if( dirh == NULL ) {
+      fprintf(stderr, "Failed to open directory '%s': %s\n", dir->path, strerror( abs(rc) ) );
+      return (rc != 0 ? rc : -EIO);
+   }
+
+   while( rc == 0 ) {
+
+      rc = UG_readdir( ctx->ug, &dirents, 1, dirh );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to read directory '%s': %s\n", dir->path, strerror( abs(rc) ) );
+         break;
+      }
+
+      if( dirents == NULL || dirents[0] == NULL ) {
+
+         // EOF
+         if( dirents != NULL ) {
+            UG_free_dir_listing( dirents );
+         }
+         break;
+      }
+
+      for( unsigned int j = 0; dirents[j] != NULL && rc == 0; j++ ) {
+
+         if( strcmp( dirents[j]->name, "." ) == 0 || strcmp( dirents[j]->name, ".." ) == 0 ) {
+            continue;
+         }
+
+         item.path = get_path_join( dir->path, dirents[j]->name );
+         item.file_path = get_path_join( dir->file_path, dirents[j]->name );
+         if( item.path == NULL || item.file_path == NULL ) {
+            get_tree_item_free( &item );
+            rc = -ENOMEM;
+            break;
+         }
+
+         if( dirents[j]->type == MD_ENTRY_DIR ) {
+
+            // make room for its files now, so they can be fetched as soon as they're found
+            if( mkdir( item.file_path, 0700 ) != 0 && errno != EEXIST ) {
+               rc = -errno;
+               fprintf(stderr, "Failed to mkdir '%s': %s\n", item.file_path, strerror(-rc));
+               get_tree_item_free( &item );
+               break;
+            }
+
+            dirs->push_back( item );
+         }
+         else {
+            files->push_back( item );
+         }
+      }
+
+      UG_free_dir_listing( dirents );
+      dirents = NULL;
+   }
+
+   UG_closedir( ctx->ug, dirh );
+   return rc;
+}
+
+
+/**
+ * @brief Recursive fetch worker (-r): list the next directory, or else fetch the next file found,
+ * until everything is done or something fails
+ *
+ * Listing comes first, so the queue of files fills up while they are being fetched.  A worker
+ * with nothing to do waits while other workers are still listing directories.
+ *
+ * @param[in] arg The get_tree
+ * @return NULL
+ */
+static void* get_tree_worker( void* arg ) {
+
+   struct get_tree* ctx = (struct get_tree*)arg;
+   struct get_tree_item item;
+   struct pipeline* pl = NULL;
+   struct pipeline_stats stats;
+   struct timespec ts_begin;
+   struct timespec ts_end;
+   std::vector<struct get_tree_item> dirs;
+   std::vector<struct get_tree_item> files;
+   ssize_t total = 0;
+   int rc = 0;
+
+   // each worker streams its files through its own buffers
+   pl = pipeline_new( ctx->buf_len, ctx->depth );
+   if( pl == NULL ) {
+
+      SG_error("%s", "Out of memory\n");
+
+      pthread_mutex_lock( &ctx->lock );
+      ctx->failed = true;
+      pthread_cond_broadcast( &ctx->cond );
+      pthread_mutex_unlock( &ctx->lock );
+      return NULL;
+   }
+
+   pthread_mutex_lock( &ctx->lock );
+
+   while( !ctx->failed ) {
+
+      if( !ctx->dirs.empty() ) {
+
+         item = ctx->dirs.front();
+         ctx->dirs.pop_front();
+         ctx->listing++;
+
+         pthread_mutex_unlock( &ctx->lock );
+
+         dirs.clear();
+         files.clear();
+
+         rc = get_tree_list( ctx, &item, &dirs, &files );
+         get_tree_item_free( &item );
+
+         pthread_mutex_lock( &ctx->lock );
+
+         ctx->listing--;
+
+         // queue what was found, even on failure, so it gets freed
+         ctx->dirs.insert( ctx->dirs.end(), dirs.begin(), dirs.end() );
+         ctx->files.insert( ctx->files.end(), files.begin(), files.end() );
+
+         if( rc != 0 ) {
+            ctx->failed = true;
+         }
+
+         pthread_cond_broadcast( &ctx->cond );
+      }
+      else if( !ctx->files.empty() ) {
+
+         item = ctx->files.front();
+         ctx->files.pop_front();
+
+         pthread_mutex_unlock( &ctx->lock );
+
+         rc = get_file( ctx->ug, ctx->opts, item.path, item.file_path, 1, ctx->io_size, pl, &total, &stats, &ts_begin, &ts_end );
+         get_tree_item_free( &item );
+
+         pthread_mutex_lock( &ctx->lock );
+
+         if( rc != 0 ) {
+            ctx->failed = true;
+         }
+         else {
+            ctx->times.push_back( md_timespec_diff_ms( &ts_end, &ts_begin ) );
+         }
+      }
+      else if( ctx->listing > 0 ) {
+
+         // a directory being listed may turn up more work
+         pthread_cond_wait( &ctx->cond, &ctx->lock );
+      }
+      else {
+
+         // all done
+         break;
+      }
+   }
+
+   pthread_cond_broadcast( &ctx->cond );
+   pthread_mutex_unlock( &ctx->lock );
+
+   pipeline_free( pl );
+   return NULL;
+}
+
+
+/**
+ * @brief Fetch a whole directory tree (-r), with a pool of workers that list directories and fetch files
+ *
+ * Files are fetched as soon as they are found, so crawling and fetching overlap.
+ *
+ * @param[in,out] ctx The fetch state, with ug, opts, io_size, buf_len and depth filled in
+ * @param[in] root Path to the directory in the volume
+ * @param[in] file_root Path to the local directory (created if need be)
+ * @param[in] num_workers Number of workers
+ * @retval 0 Success
+ * @retval 1 Failure (the reason is printed to stderr)
+ */
+static int get_tree( struct get_tree* ctx, char const* root, char const* file_root, int num_workers ) {
+
+   int rc = 0;
+   struct get_tree_item item;
+   pthread_t* threads = NULL;
+
+   if( mkdir( file_root, 0700 ) != 0 && errno != EEXIST ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to mkdir '%s': %s\n", file_root, strerror(-rc));
+      return 1;
+   }
+
+   item.path = SG_strdup_or_null( root );
+   item.file_path = SG_strdup_or_null( file_root );
+   threads = SG_CALLOC( pthread_t, num_workers );
+
+   if( item.path == NULL || item.file_path == NULL || threads == NULL ) {
+      get_tree_item_free( &item );
+      SG_safe_free( threads );
+      SG_error("%s", "Out of memory\n");
+      return 1;
+   }
+
+   ctx->dirs.push_back( item );
+
+   rc = start_threads( threads, num_workers, get_tree_worker, ctx );
+   if( rc < 0 ) {
+      fprintf(stderr, "Failed to start fetch threads: %s\n", strerror(-rc));
+      ctx->failed = true;
+   }
+   else {
+      join_threads( threads, rc );
+   }
+
+   // anything left over was cut short by a failure
+   for( size_t i = 0; i < ctx->dirs.size(); i++ ) {
+      get_tree_item_free( &ctx->dirs[i] );
+   }
+
+   for( size_t i = 0; i < ctx->files.size(); i++ ) {
+      get_tree_item_free( &ctx->files[i] );
+   }
+
+   ctx->dirs.clear();
+   ctx->files.clear();
+
+   SG_safe_free( threads );
+
+   return (ctx->failed ? 1 : 0);
+}
+
 
 /**
  * @brief syndicate-get entry point
@@ -40,11 +1250,13 @@ int main( int argc, char** argv ) {
    char* path = NULL;
    int path_optind = 0;
    char* file_path = NULL;
-   int fd = 0;
-   char* buf = NULL;
-   ssize_t nr = 0;
+   struct pipeline* pl = NULL;
+   struct pipeline_stats stats;
+   struct get_tree tree;
+   uint64_t buffer_size = 0;
+   uint64_t io_size = 0;
+   int depth = 0;
    ssize_t total = 0;
-   UG_handle_t* fh = NULL;
 
    int t = 0;
    struct timespec ts_begin;
@@ -58,10 +1270,11 @@ int main( int argc, char** argv ) {
 
    memset( &opts, 0, sizeof(tool_opts) );
 
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, TOOL_OPT_JOBS | TOOL_OPT_RECURSIVE | TOOL_OPT_BUFFER | TOOL_OPT_DEPTH | TOOL_OPT_IO_SIZE | TOOL_OPT_RESUME | TOOL_OPT_UPDATE | TOOL_OPT_SPARSE );
    if( argc < 0 ) {
 
-      usage( argv[0], "syndicate_file local_file [syndicate_file local_file...]" );
+      usage( argv[0], "[-j|--jobs N] [--buffer SIZE] [--depth N] [--io-size SIZE] [--resume] [--update] [--sparse] syndicate_file local_file [syndicate_file local_file...]" );
+      usage( argv[0], "-r|--recursive [-j|--jobs N] [OPTION]... syndicate_dir local_dir" );
       md_common_usage();
       exit(1);
    }
@@ -78,13 +1291,63 @@ int main( int argc, char** argv ) {
 
    // get the path...
    path_optind = SG_gateway_first_arg_optind( gateway );
-   if( path_optind == argc || ((argc - path_optind) % 2) != 0 ) {
+   if( path_optind == argc || ((argc - path_optind) % 2) != 0 || (opts.recursive && argc - path_optind != 2) ) {
+
+      usage( argv[0], "[-j|--jobs N] [--buffer SIZE] [--depth N] [--io-size SIZE] [--resume] [--update] [--sparse] syndicate_file local_file [syndicate_file local_file]" );
+      usage( argv[0], "-r|--recursive [-j|--jobs N] [OPTION]... syndicate_dir local_dir" );
+      UG_shutdown( ug );
+      exit(1);
+   }
+
+   // transfer buffers: default to two of BUF_SIZE
+   depth = (opts.depth > 0 ? opts.depth : PIPELINE_DEPTH);
+   buffer_size = (opts.buffer_size > 0 ? opts.buffer_size : (uint64_t)depth * BUF_SIZE);
+
+   io_size = get_io_size( ug, &opts );
+
+   // stay within --buffer, even if that means fewer buffers (the default grows to fit the I/O unit)
+   if( opts.buffer_size > 0 ) {
+      depth = io_depth( buffer_size, io_size, depth );
+   }
+
+   if( depth < 0 ) {
 
-      usage( argv[0], "syndicate_file local_file [syndicate_file local_file]" );
+      fprintf(stderr, "Buffer size %" PRIu64 " is too small for two %" PRIu64 "-byte I/O units\n", buffer_size, io_size );
       UG_shutdown( ug );
       exit(1);
    }
 
+   if( opts.recursive ) {
+
+      // every worker fetches whole files through buffers of its own
+      tree.ug = ug;
+      tree.opts = &opts;
+      tree.io_size = io_size;
+      tree.buf_len = io_align( buffer_size / depth, io_size );
+      tree.depth = depth;
+      tree.listing = 0;
+      tree.failed = false;
+
+      pthread_mutex_init( &tree.lock, NULL );
+      pthread_cond_init( &tree.cond, NULL );
+
+      rc = get_tree( &tree, argv[path_optind], argv[path_optind + 1], std::max( opts.jobs, 1 ) );
+
+      pthread_mutex_destroy( &tree.lock );
+      pthread_cond_destroy( &tree.cond );
+
+      if( opts.benchmark && tree.times.size() > 0 ) {
+
+         times = SG_CALLOC( int64_t, tree.times.size() );
+         if( times != NULL ) {
+            memcpy( times, &tree.times[0], tree.times.size() * sizeof(int64_t) );
+            t = tree.times.size();
+         }
+      }
+
+      goto get_end;
+   }
+
    if( opts.benchmark ) {
       times = SG_CALLOC( int64_t, (argc - path_optind) / 2 + 1 );
       if( times == NULL ) {
@@ -94,8 +1357,8 @@ int main( int argc, char** argv ) {
       }
    }
 
-   buf = SG_CALLOC( char, BUF_SIZE );
-   if( buf == NULL ) {
+   pl = pipeline_new( io_align( buffer_size / depth, io_size ), depth );
+   if( pl == NULL ) {
       UG_shutdown( ug );
       SG_error("%s", "Out of memory\n");
       exit(1);
@@ -103,67 +1366,14 @@ int main( int argc, char** argv ) {
 
    for( int i = path_optind; i < argc; i += 2 ) {
 
-       total = 0;
-
        // get the syndicate path...
        path = argv[i];
 
        // get the file path...
        file_path = argv[i+1];
 
-       // open the file...
-       fd = open( file_path, O_CREAT | O_EXCL | O_WRONLY, 0600 );
-       if( fd < 0 ) {
-          rc = -errno;
-          fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
-          rc = 1;
-          goto get_end;
-       }
-
-       // try to open
-       fh = UG_open( ug, path, O_RDONLY, &rc );
+       rc = get_file( ug, &opts, path, file_path, opts.jobs, io_size, pl, &total, &stats, &ts_begin, &ts_end );
        if( rc != 0 ) {
-          fprintf(stderr, "Failed to open '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
-          rc = 1;
-          goto get_end;
-       }
-
-       clock_gettime( CLOCK_MONOTONIC, &ts_begin );
-       while( 1 ) {
-          nr = UG_read( ug, buf, BUF_SIZE, fh );
-          if( nr == 0 ) {
-             break;
-          }
-          if( nr < 0 ) {
-            rc = nr;
-            fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(abs(rc)));
-            break;
-          }
-
-          rc = write( fd, buf, nr );
-          if( rc < 0 ) {
-             rc = -errno;
-             fprintf(stderr, "Failed to write '%s': %d %s\n", file_path, rc, strerror(abs(rc)));
-             break;
-          }
-
-          total += nr;
-       }
-
-       close( fd );
-
-       if( rc < 0 ) {
-          rc = 1;
-          goto get_end;
-       }
-
-       clock_gettime( CLOCK_MONOTONIC, &ts_end );
-
-       // close
-       rc = UG_close( ug, fh );
-       if( rc != 0 ) {
-          fprintf(stderr, "Failed to close '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
-          rc = 1;
           goto get_end;
        }
 
@@ -171,27 +1381,32 @@ int main( int argc, char** argv ) {
           printf("\n%ld.%ld - %ld.%ld = %ld\n", ts_end.tv_sec, ts_end.tv_nsec, ts_begin.tv_sec, ts_begin.tv_nsec, md_timespec_diff_ms( &ts_end, &ts_begin ));
           times[t] = md_timespec_diff_ms( &ts_end, &ts_begin );
           t++;
-       }
 
-       SG_debug("Read %zd bytes for %s\n", total, path );
+          if( opts.jobs <= 1 && !opts.resume && !opts.update ) {
+
+             // which stage is the bottleneck?
+             printf("fetch %" PRId64 " ms (stalled %" PRId64 " ms), write %" PRId64 " ms (stalled %" PRId64 " ms)\n",
+                    stats.fill_ns / 1000000, stats.fill_wait_ns / 1000000, stats.drain_ns / 1000000, stats.drain_wait_ns / 1000000 );
+          }
+       }
    }
 
 get_end:
 
    UG_shutdown( ug );
-   SG_safe_free( buf );
+   pipeline_free( pl );
 
-   if( times != NULL ) {
+   if( times != NULL && t > 0 ) {
 
       printf("@@@@@");
       for( int i = 0; i < t - 1; i++ ) {
          printf("%" PRId64 ",", times[i] );
       }
       printf("%" PRId64 "@@@@@\n", times[t-1] );
-
-      SG_safe_free( times );
    }
 
+   SG_safe_free( times );
+
    if( rc != 0 ) {
       exit(1);
    }
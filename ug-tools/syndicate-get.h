@@ -39,6 +39,33 @@
  * @section description DESCRIPTION
  * Copy files from a syndicate volume to the local file system
  *
+ * @section options OPTIONS
+ * -j, --jobs N\n
+ * Fetch each file with N workers.  Each worker reads block-aligned byte ranges with its own file handle and writes them into place in the local file.  Workers that run out of work split the largest remaining range.
+ *
+ * -r, --recursive\n
+ * Copy the directory tree SYNDICATE_DIR out of the volume into LOCAL_DIR (syndicate-get -r SYNDICATE_DIR LOCAL_DIR).  A pool of workers (see -j) lists directories with UG_opendir and UG_readdir, creates their local copies, and fetches each file as soon as it is found, so crawling and fetching overlap.  Each worker fetches one file at a time through transfer buffers of its own.  Existing local directories are filled in.  Existing local files are not overwritten unless --update or --resume is given.
+ *
+ * --buffer SIZE\n
+ * Use at most SIZE bytes of transfer buffers in total (K, M and G suffixes are allowed).  Each buffer holds at least one I/O unit (see --io-size), so fewer buffers than --depth are used if SIZE is too small for them, and SIZE must hold at least two I/O units.  The default is 20M, or one I/O unit per buffer if that is larger.
+ *
+ * --depth N\n
+ * Split the transfer buffers into N buffers (at least 2, the default).  One stage fetches into the next empty buffer while the other writes the oldest full one to the local file.
+ *
+ * With -B, the time each stage spent working and waiting on the other is printed for each file.
+ *
+ * --io-size SIZE\n
+ * Read from Syndicate in whole multiples of SIZE bytes, starting at multiples of SIZE (K, M and G suffixes are allowed).  Buffers are rounded down to a multiple of SIZE.  The default is the volume's block size.
+ *
+ * --resume\n
+ * Keep a journal next to each DEST (DEST.sg-journal) that records the version of SOURCE and every chunk written to DEST once it is on disk.  If the fetch is interrupted, running the same command again with --resume fetches only the chunks that are missing, as long as SOURCE has not changed since; otherwise DEST is fetched again from the start.  The journal is removed once DEST is complete.  A DEST that exists without a journal is never overwritten.  Chunks are fetched as with -j (with one worker if -j is not given).
+ *
+ * --update\n
+ * If DEST exists, bring it up to date instead of refusing to overwrite it.  DEST and SOURCE are compared block by block (SHA-256, one block per I/O unit, hashed on as many threads as there are CPUs), only the blocks that differ are fetched and written into place, and DEST is truncated to the size of SOURCE.  The hashes of SOURCE are taken from its user.syndicate.blockhash xattr (see syndicate-put --delta) if they are current, and are computed by reading SOURCE otherwise.  Blocks are fetched as with -j (with one worker if -j is not given).  --resume does not apply with --update.
+ *
+ * --sparse\n
+ * Leave the blocks of SOURCE (one I/O unit each) that are all zeros out of DEST, so they become holes and take no space.  DEST is truncated to the size of SOURCE at the end, in case SOURCE ends in zeros.  With --resume and --update, DEST may already have data where a zero block goes, so the block is punched out of DEST with fallocate() instead (or written, if the local file system can't punch holes).  Checking a block costs about as much as copying it, so dense files are not slowed down.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -67,6 +94,14 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <pthread.h>
+
 #include "common.h"
+#include "pipeline.h"
+#include "journal.h"
+#include "blockhash.h"
+
+#include <deque>
+#include <vector>
 
 #endif
@@ -49,7 +49,7 @@ int main( int argc, char** argv ) {
    
    memset( &opts, 0, sizeof(tool_opts) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, 0 );
    if( argc < 0 ) {
       
       usage( argv[0], "path [path...]" );
@@ -27,6 +27,1656 @@
 #include "syndicate-put.h"
 
 #define BUF_SIZE 1024 * 1024 * 10
+#define PIPELINE_DEPTH 2
+#define CHECKPOINT_SIZE 1024 * 1024 * 256
+#define JOURNAL_SUFFIX ".sg-journal"
+#define BLOCKS_SUFFIX ".sg-blocks"
+#define DIGEST_SUFFIX ".sg-digest"
+#define GROUP_COMMIT_MAX 64
+#define PUT_COMMIT_PENDING 2
+
+/**
+ * @brief One local_file/syndicate_file pair to upload
+ */
+struct put_job {
+   char const* file_path;          ///< Path to the local file
+   char const* path;               ///< Path to the file in the volume
+   uint64_t size;                  ///< Size of the local file, if known (-r uploads the largest ready file first)
+   unsigned char digest[BLOCKHASH_LEN];    ///< Digest of the local file (--skip-unchanged)
+   bool has_digest;                ///< if true, publish digest on the file in the volume once it is fsynced
+   int rc;                         ///< 0 on success; nonzero on failure
+   bool done;                      ///< if true, the upload has finished (successfully or not)
+   struct timespec ts_begin;       ///< When the fsync started
+   struct timespec ts_end;         ///< When the fsync finished
+};
+
+/**
+ * @brief A local directory to recreate in the volume (-r)
+ */
+struct put_dir {
+   char* file_path;                ///< Path to the local directory
+   char* path;                     ///< Path to the directory in the volume
+   mode_t mode;                    ///< Permission bits to create it with
+   std::vector<int> dirs;          ///< Indexes of its subdirectories
+   std::vector<int> files;         ///< Indexes of the uploads of the regular files in it
+};
+
+/**
+ * @brief Work left in a recursive upload (-r)
+ *
+ * Directories are created breadth-first, each as soon as its parent exists.  Once a
+ * directory exists, its files are ready, and workers take the largest ready file first,
+ * so the big files that bound the total time start early and small ones fill in at the end.
+ */
+struct put_tree {
+   std::vector<struct put_dir> dirs;   ///< All directories; dirs[0] is the top one
+   std::deque<int> mkdirs;             ///< Directories whose parent exists, in breadth-first order
+   std::vector<int> ready;             ///< Heap of the uploads whose directory exists, largest on top
+   int mkdirs_running;                 ///< Number of directories being created right now
+};
+
+/**
+ * @brief An upload whose data is written, waiting for its fsync (--group-commit)
+ */
+struct put_commit {
+   struct put_job* job;            ///< The upload
+   UG_handle_t* fh;                ///< Its open handle, closed once it is fsynced
+   struct journal* journal;        ///< Its journal (--resume), removed once it is fsynced
+   unsigned char* hashes;          ///< Its block hashes (--delta), published once it is fsynced
+   struct stat sb;                 ///< The local file's metadata, when it was read
+};
+
+/**
+ * @brief Background thread that fsyncs and closes uploads in the order their data was written (--group-commit)
+ */
+struct put_committer {
+   std::deque<struct put_commit> queue;    ///< Uploads waiting for their fsync, oldest first
+   bool stop;                      ///< if true, exit once the queue is empty
+   bool running;                   ///< if true, the thread was started
+   pthread_t thread;               ///< The thread
+   pthread_cond_t cond;            ///< Signaled whenever the queue changes, or stop is set
+};
+
+/**
+ * @brief Upload state shared by all worker threads
+ */
+struct put_ctx {
+   struct UG_state* ug;            ///< State of UG, shared by all workers
+   struct tool_opts* opts;         ///< Tool options
+   size_t buf_len;                 ///< Bytes per UG_write (a whole number of I/O units)
+   uint64_t io_size;               ///< I/O unit; --delta compares and rewrites blocks of this size
+   int hash_threads;               ///< Threads to hash blocks with (--delta)
+   uint64_t checkpoint;            ///< With --resume, UG_fsync and journal the upload every this many bytes (a whole number of buffers)
+   struct put_job* jobs;           ///< Uploads, in argument order
+   int num_jobs;                   ///< Number of uploads
+   int next_job;                   ///< Index of the next upload to hand out
+   struct put_tree* tree;          ///< With -r, the directories to create and the order to upload in (otherwise NULL)
+   struct put_committer* committer;    ///< With --group-commit, where uploads go to be fsynced and closed (otherwise NULL)
+   struct nameset* names;          ///< Which files existed in the volume before the uploads started, if known (otherwise NULL)
+   bool failed;                    ///< if true, an upload failed and no more will be handed out
+   pthread_mutex_t lock;           ///< Lock protecting the above
+   pthread_cond_t done_cond;       ///< Signaled whenever an upload finishes
+};
+
+
+/**
+ * @brief Drain closure that commits the upload every so often (--resume, and uploads from stdin)
+ */
+struct put_checkpoint {
+   struct pipeline_ug* ugf;        ///< Where the bytes go
+   struct journal* journal;        ///< Where commits are recorded, or NULL to just fsync
+   char const* path;               ///< Path to the file in the volume
+   uint64_t pos;                   ///< Offset of the next byte to write
+   uint64_t committed;             ///< Offset up to which the file is fsynced and journaled
+   uint64_t interval;              ///< Bytes to write between commits
+};
+
+
+/**
+ * @brief Drain stage that writes to the volume, and fsyncs (and journals, if there is a journal) the file at each checkpoint
+ *
+ * @param[in] cls A struct put_checkpoint
+ */
+static int put_drain_checkpoint( void* cls, char* buf, size_t len ) {
+
+   struct put_checkpoint* cp = (struct put_checkpoint*)cls;
+   int rc = 0;
+
+   rc = pipeline_drain_ug( cp->ugf, buf, len );
+   if( rc != 0 ) {
+      return rc;
+   }
+
+   cp->pos += len;
+
+   if( cp->pos - cp->committed < cp->interval ) {
+      return 0;
+   }
+
+   rc = UG_fsync( cp->ugf->ug, cp->ugf->fh );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to fsync '%s': %d %s\n", cp->path, rc, strerror( abs(rc) ) );
+      return rc;
+   }
+
+   if( cp->journal != NULL ) {
+
+      rc = journal_append( cp->journal, cp->committed, cp->pos - cp->committed );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+
+   SG_debug("Checkpoint '%s' at %" PRIu64 "\n", cp->path, cp->pos );
+
+   cp->committed = cp->pos;
+   return 0;
+}
+
+
+/**
+ * @brief Find out how much of an interrupted upload is already committed, and seek both files past it (--resume)
+ *
+ * The journal lives next to the local file.  It is only trusted if the local file's size and
+ * modification time and the remote file's ID and version are what they were when it was
+ * started, and the remote file is still at least as long as the committed prefix.
+ *
+ * @param[in] ug The UG state
+ * @param[in] job The upload
+ * @param[in] sb The local file's stat
+ * @param[in] fd Local file descriptor
+ * @param[in] fh Remote file handle
+ * @param[out] journal The upload's journal
+ * @param[out] offset Where the upload picks up
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_resume_begin( struct UG_state* ug, struct put_job* job, struct stat* sb, int fd, UG_handle_t* fh, struct journal** journal, uint64_t* offset ) {
+
+   int rc = 0;
+   struct md_entry ent;
+   char* header = NULL;
+   char* journal_path = NULL;
+   size_t header_len = 0;
+   off_t pos = 0;
+
+   *offset = 0;
+
+   rc = UG_stat_raw( ug, job->path, &ent );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to stat '%s': %d %s\n", job->path, rc, strerror( abs(rc) ) );
+      return rc;
+   }
+
+   header_len = strlen(job->path) + 128;
+   header = SG_CALLOC( char, header_len );
+   journal_path = SG_CALLOC( char, strlen(job->file_path) + strlen(JOURNAL_SUFFIX) + 1 );
+   if( header == NULL || journal_path == NULL ) {
+      md_entry_free( &ent );
+      SG_safe_free( header );
+      SG_safe_free( journal_path );
+      return -ENOMEM;
+   }
+
+   snprintf( header, header_len, "syndicate-put %s %jd %ld.%09ld %" PRIX64 " %" PRId64,
+             job->path, (intmax_t)sb->st_size, (long)sb->st_mtim.tv_sec, (long)sb->st_mtim.tv_nsec, ent.file_id, ent.version );
+   sprintf( journal_path, "%s%s", job->file_path, JOURNAL_SUFFIX );
+
+   rc = journal_open( journal_path, header, journal );
+   if( rc == JOURNAL_RESUMED ) {
+
+      *offset = journal_prefix( *journal );
+
+      if( *offset > (uint64_t)sb->st_size || *offset > (uint64_t)ent.size ) {
+
+         // the remote file lost data we committed; start over
+         SG_debug("'%s' is shorter than its journal says; starting over\n", job->path );
+         *offset = 0;
+
+         rc = journal_remove( *journal );
+         *journal = NULL;
+
+         if( rc == 0 ) {
+            rc = journal_open( journal_path, header, journal );
+         }
+      }
+   }
+
+   md_entry_free( &ent );
+   SG_safe_free( header );
+   SG_safe_free( journal_path );
+
+   if( rc < 0 ) {
+      return rc;
+   }
+
+   if( *offset == 0 ) {
+      return 0;
+   }
+
+   SG_debug("Resuming '%s' at %" PRIu64 "\n", job->path, *offset );
+
+   // skip the committed prefix
+   if( lseek( fd, *offset, SEEK_SET ) < 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to seek '%s': %s\n", job->file_path, strerror(-rc));
+      return rc;
+   }
+
+   pos = UG_seek( fh, *offset, SEEK_SET );
+   if( pos < 0 || (uint64_t)pos != *offset ) {
+      rc = (pos < 0 ? (int)pos : -EIO);
+      fprintf(stderr, "Failed to seek '%s': %s\n", job->path, strerror(abs(rc)));
+      return rc;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Get the path to one of a local file's sidecar files (e.g. its block hash cache)
+ *
+ * @return The path (to be freed), or NULL if out of memory
+ */
+static char* put_sidecar_path( char const* file_path, char const* suffix ) {
+
+   char* cache_path = SG_CALLOC( char, strlen(file_path) + strlen(suffix) + 1 );
+
+   if( cache_path != NULL ) {
+      sprintf( cache_path, "%s%s", file_path, suffix );
+   }
+
+   return cache_path;
+}
+
+
+/**
+ * @brief Check whether a name is one of the sidecar files this tool keeps next to local files
+ */
+static bool put_is_sidecar( char const* name ) {
+
+   static char const* suffixes[] = { JOURNAL_SUFFIX, BLOCKS_SUFFIX, DIGEST_SUFFIX };
+   size_t len = strlen(name);
+
+   for( size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++ ) {
+
+      size_t suffix_len = strlen(suffixes[i]);
+      if( len > suffix_len && strcmp( name + len - suffix_len, suffixes[i] ) == 0 ) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/**
+ * @brief Get the digest of a local file (--skip-unchanged)
+ *
+ * The digest is cached next to the file (FILE.sg-digest), keyed by the file's device,
+ * inode, modification time and size, so an unchanged file is not hashed again.
+ *
+ * @param[in] ctx The upload state
+ * @param[in] job The upload
+ * @param[in] sb The local file's metadata
+ * @param[in] fd The local file
+ * @param[out] digest Room for BLOCKHASH_LEN bytes
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_digest_local( struct put_ctx* ctx, struct put_job* job, struct stat* sb, int fd, unsigned char* digest ) {
+
+   int rc = 0;
+   char header[BLOCKHASH_HEADER_MAX];
+   char* cache_path = NULL;
+
+   snprintf( header, BLOCKHASH_HEADER_MAX, "syndicate-digest %ju %ju %jd %ld %jd",
+             (uintmax_t)sb->st_dev, (uintmax_t)sb->st_ino, (intmax_t)sb->st_mtim.tv_sec, sb->st_mtim.tv_nsec, (intmax_t)sb->st_size );
+
+   cache_path = put_sidecar_path( job->file_path, DIGEST_SUFFIX );
+   if( cache_path == NULL ) {
+      return -ENOMEM;
+   }
+
+   rc = blockhash_cache_load( cache_path, header, 1, digest );
+   if( rc != 0 ) {
+
+      rc = blockhash_digest_local( fd, sb->st_size, ctx->hash_threads, digest );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to hash '%s': %s\n", job->file_path, strerror(abs(rc)));
+      }
+      else {
+
+         // the cache is only an optimization (e.g. the source may be read-only)
+         int store_rc = blockhash_cache_store( cache_path, header, 1, digest );
+         if( store_rc != 0 ) {
+            SG_debug("Failed to cache the digest of '%s' in '%s': %s\n", job->file_path, cache_path, strerror(abs(store_rc)) );
+         }
+      }
+   }
+
+   SG_safe_free( cache_path );
+   return rc;
+}
+
+
+/**
+ * @brief Check whether the file in the volume already has a local file's contents (--skip-unchanged)
+ *
+ * @param[in] ctx The upload state
+ * @param[in] job The upload, with its digest
+ * @param[in] sb The local file's metadata
+ * @return true if the file in the volume was last published with the same digest, and has not been written since
+ */
+static bool put_digest_matches( struct put_ctx* ctx, struct put_job* job, struct stat* sb ) {
+
+   int rc = 0;
+   struct md_entry ent;
+   char* header = NULL;
+   unsigned char remote_digest[BLOCKHASH_LEN];
+
+   rc = UG_stat_raw( ctx->ug, job->path, &ent );
+   if( rc != 0 ) {
+      return false;
+   }
+
+   // different sizes can't match
+   if( ent.size != sb->st_size ) {
+      md_entry_free( &ent );
+      return false;
+   }
+
+   header = blockhash_header( &ent, BLOCKHASH_DIGEST_BLOCK_SIZE );
+   md_entry_free( &ent );
+
+   if( header == NULL ) {
+      return false;
+   }
+
+   rc = blockhash_digest_xattr_load( ctx->ug, job->path, header, remote_digest );
+   SG_safe_free( header );
+
+   return (rc == 0 && memcmp( remote_digest, job->digest, BLOCKHASH_LEN ) == 0);
+}
+
+
+/**
+ * @brief Publish an upload's digest on the file in the volume, once it is fsynced (--skip-unchanged)
+ *
+ * Failure only means the next --skip-unchanged upload of the file can't be skipped.
+ *
+ * @param[in] ctx The upload state
+ * @param[in] job The upload, with its digest
+ */
+static void put_digest_finish( struct put_ctx* ctx, struct put_job* job ) {
+
+   struct md_entry ent;
+   char* header = NULL;
+   int rc = 0;
+
+   rc = UG_stat_raw( ctx->ug, job->path, &ent );
+   if( rc != 0 ) {
+      return;
+   }
+
+   header = blockhash_header( &ent, BLOCKHASH_DIGEST_BLOCK_SIZE );
+   md_entry_free( &ent );
+
+   if( header != NULL ) {
+      blockhash_digest_xattr_store( ctx->ug, job->path, header, job->digest );
+   }
+
+   SG_safe_free( header );
+}
+
+
+/**
+ * @brief Write the local blocks whose hashes differ from the remote file's, then trim the remote file to size (--delta)
+ *
+ * The remote file's block hashes come from the cache next to the local file or from
+ * the remote file's xattr, if either describes the remote file as it is now, and are
+ * computed by reading the remote file otherwise.  Runs of differing blocks are written
+ * with one seek each.
+ *
+ * @param[in] ctx The upload state
+ * @param[in] job The upload
+ * @param[in] sb The local file's stat
+ * @param[in] fd Local file descriptor
+ * @param[in] fh Remote file handle
+ * @param[in] existed If false, the remote file was just created, and every block is written
+ * @param[out] hashes Set to the local file's block hashes, to be freed by the caller
+ * @param[out] written Bytes written
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_delta( struct put_ctx* ctx, struct put_job* job, struct stat* sb, int fd, UG_handle_t* fh, bool existed, unsigned char** hashes, uint64_t* written ) {
+
+   int rc = 0;
+   struct UG_state* ug = ctx->ug;
+   struct md_entry ent;
+   uint64_t bs = ctx->io_size;
+   uint64_t size = sb->st_size;
+   uint64_t remote_size = 0;
+   uint64_t num_blocks = blockhash_count( size, bs );
+   uint64_t remote_blocks = 0;
+   unsigned char* local_hashes = NULL;
+   unsigned char* remote_hashes = NULL;
+   char* header = NULL;
+   char* cache_path = NULL;
+   char* buf = NULL;
+   uint64_t run_start = 0;
+   uint64_t run_end = 0;
+   uint64_t len = 0;
+   ssize_t nr = 0;
+   ssize_t nw = 0;
+   off_t pos = 0;
+
+   *written = 0;
+
+   local_hashes = SG_CALLOC( unsigned char, num_blocks * BLOCKHASH_LEN + 1 );
+   buf = SG_CALLOC( char, ctx->buf_len );
+   if( local_hashes == NULL || buf == NULL ) {
+      rc = -ENOMEM;
+      goto put_delta_end;
+   }
+
+   rc = blockhash_local( fd, size, bs, ctx->hash_threads, local_hashes );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to hash '%s': %s\n", job->file_path, strerror(abs(rc)));
+      goto put_delta_end;
+   }
+
+   if( existed ) {
+
+      rc = UG_stat_raw( ug, job->path, &ent );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to stat '%s': %d %s\n", job->path, rc, strerror( abs(rc) ) );
+         goto put_delta_end;
+      }
+
+      remote_size = ent.size;
+      remote_blocks = blockhash_count( remote_size, bs );
+
+      header = blockhash_header( &ent, bs );
+      cache_path = put_sidecar_path( job->file_path, BLOCKS_SUFFIX );
+      remote_hashes = SG_CALLOC( unsigned char, remote_blocks * BLOCKHASH_LEN + 1 );
+
+      md_entry_free( &ent );
+
+      if( header == NULL || cache_path == NULL || remote_hashes == NULL ) {
+         rc = -ENOMEM;
+         goto put_delta_end;
+      }
+
+      // cached from the last upload, or published by whoever wrote it last, if nothing has written to the file since
+      rc = blockhash_cache_load( cache_path, header, remote_blocks, remote_hashes );
+      if( rc != 0 ) {
+         rc = blockhash_xattr_load( ug, job->path, header, remote_blocks, remote_hashes );
+      }
+
+      if( rc != 0 ) {
+
+         rc = blockhash_remote( ug, job->path, remote_size, bs, ctx->hash_threads, remote_hashes );
+         if( rc != 0 ) {
+            fprintf(stderr, "Failed to hash '%s': %s\n", job->path, strerror(abs(rc)));
+            goto put_delta_end;
+         }
+      }
+   }
+
+   // write each run of blocks that differ
+   for( uint64_t b = 0; b < num_blocks; b = run_end ) {
+
+      if( b < remote_blocks && memcmp( local_hashes + b * BLOCKHASH_LEN, remote_hashes + b * BLOCKHASH_LEN, BLOCKHASH_LEN ) == 0 ) {
+         run_end = b + 1;
+         continue;
+      }
+
+      for( run_end = b + 1; run_end < num_blocks; run_end++ ) {
+
+         if( run_end < remote_blocks && memcmp( local_hashes + run_end * BLOCKHASH_LEN, remote_hashes + run_end * BLOCKHASH_LEN, BLOCKHASH_LEN ) == 0 ) {
+            break;
+         }
+      }
+
+      run_start = b * bs;
+      len = std::min( run_end * bs, size ) - run_start;
+
+      SG_debug("'%s': write %" PRIu64 " bytes at %" PRIu64 "\n", job->path, len, run_start );
+
+      pos = UG_seek( fh, run_start, SEEK_SET );
+      if( pos < 0 || (uint64_t)pos != run_start ) {
+         rc = (pos < 0 ? (int)pos : -EIO);
+         fprintf(stderr, "Failed to seek '%s': %s\n", job->path, strerror(abs(rc)));
+         goto put_delta_end;
+      }
+
+      while( len > 0 ) {
+
+         nr = pread( fd, buf, std::min( len, (uint64_t)ctx->buf_len ), run_start );
+         if( nr <= 0 ) {
+
+            if( nr < 0 && errno == EINTR ) {
+               continue;
+            }
+
+            rc = (nr < 0 ? -errno : -ENODATA);
+            fprintf(stderr, "Failed to read '%s': %s\n", job->file_path, strerror(-rc));
+            goto put_delta_end;
+         }
+
+         nw = UG_write( ug, buf, nr, fh );
+         if( nw != nr ) {
+            rc = (nw < 0 ? (int)nw : -EIO);
+            fprintf(stderr, "Failed to write '%s': %d %s\n", job->path, rc, strerror(abs(rc)));
+            goto put_delta_end;
+         }
+
+         run_start += nr;
+         len -= nr;
+         *written += nr;
+      }
+   }
+
+   // drop the old tail
+   if( size < remote_size ) {
+
+      rc = UG_ftruncate( ug, size, fh );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to truncate '%s': %d %s\n", job->path, rc, strerror(abs(rc)));
+         goto put_delta_end;
+      }
+   }
+
+   SG_debug("'%s': wrote %" PRIu64 " of %" PRIu64 " bytes\n", job->path, *written, size );
+
+put_delta_end:
+
+   if( rc == 0 ) {
+      *hashes = local_hashes;
+   }
+   else {
+      SG_safe_free( local_hashes );
+   }
+
+   SG_safe_free( remote_hashes );
+   SG_safe_free( header );
+   SG_safe_free( cache_path );
+   SG_safe_free( buf );
+
+   return rc;
+}
+
+
+/**
+ * @brief Remember the block hashes of what was just uploaded, so the next --delta upload need not read the remote file
+ *
+ * The hashes are also published on the remote file, so syndicate-get --update can use them.
+ * Failing to do either is not an error; the remote file is just read instead.
+ */
+static void put_delta_finish( struct put_ctx* ctx, struct put_job* job, struct stat* sb, unsigned char* hashes ) {
+
+   struct md_entry ent;
+   char* header = NULL;
+   char* cache_path = NULL;
+   int rc = 0;
+
+   rc = UG_stat_raw( ctx->ug, job->path, &ent );
+   if( rc != 0 ) {
+      return;
+   }
+
+   header = blockhash_header( &ent, ctx->io_size );
+   cache_path = put_sidecar_path( job->file_path, BLOCKS_SUFFIX );
+
+   md_entry_free( &ent );
+
+   if( header != NULL && cache_path != NULL ) {
+
+      rc = blockhash_cache_store( cache_path, header, blockhash_count( sb->st_size, ctx->io_size ), hashes );
+      if( rc != 0 ) {
+         SG_debug("Failed to cache block hashes in '%s': %s\n", cache_path, strerror(abs(rc)) );
+      }
+
+      blockhash_xattr_store( ctx->ug, job->path, header, blockhash_count( sb->st_size, ctx->io_size ), hashes );
+   }
+
+   SG_safe_free( header );
+   SG_safe_free( cache_path );
+}
+
+
+/**
+ * @brief Write part of a buffer to the remote file, seeking first unless the handle is already there
+ *
+ * @param[in,out] pos The remote handle's offset
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_write_at( struct UG_state* ug, UG_handle_t* fh, char const* path, char* buf, uint64_t len, uint64_t offset, uint64_t* pos ) {
+
+   off_t new_pos = 0;
+   ssize_t nw = 0;
+
+   if( *pos != offset ) {
+
+      new_pos = UG_seek( fh, offset, SEEK_SET );
+      if( new_pos < 0 || (uint64_t)new_pos != offset ) {
+         nw = (new_pos < 0 ? new_pos : -EIO);
+         fprintf(stderr, "Failed to seek '%s': %s\n", path, strerror(abs(nw)));
+         return (int)nw;
+      }
+
+      *pos = offset;
+   }
+
+   nw = UG_write( ug, buf, len, fh );
+   if( nw < 0 || (uint64_t)nw != len ) {
+      nw = (nw < 0 ? nw : -EIO);
+      fprintf(stderr, "Failed to write '%s': %d %s\n", path, (int)nw, strerror(abs(nw)));
+      return (int)nw;
+   }
+
+   *pos += len;
+   return 0;
+}
+
+
+/**
+ * @brief Upload only the data extents of a sparse local file, and with --detect-zeros, only its nonzero blocks (--sparse)
+ *
+ * The local file is walked with SEEK_DATA/SEEK_HOLE; on filesystems that can't report
+ * holes, the whole file is one data extent.  Extents are widened to I/O unit boundaries.
+ * An existing remote file is truncated to 0 first, so that whatever is skipped reads back
+ * as zeros, and the remote file is extended to the local file's size at the end.
+ *
+ * @param[in] ctx The upload state
+ * @param[in] job The upload
+ * @param[in] sb The local file's stat
+ * @param[in] fd Local file descriptor
+ * @param[in] fh Remote file handle
+ * @param[in] existed If true, the remote file existed before this upload
+ * @param[out] written Bytes written
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_sparse( struct put_ctx* ctx, struct put_job* job, struct stat* sb, int fd, UG_handle_t* fh, bool existed, uint64_t* written ) {
+
+   int rc = 0;
+   struct UG_state* ug = ctx->ug;
+   uint64_t bs = ctx->io_size;
+   uint64_t size = sb->st_size;
+   uint64_t pos = 0;
+   uint64_t off = 0;
+   uint64_t data = 0;
+   uint64_t hole = 0;
+   uint64_t len = 0;
+   uint64_t run = 0;
+   uint64_t block_len = 0;
+   off_t where = 0;
+   ssize_t nr = 0;
+   char* buf = NULL;
+
+   *written = 0;
+
+   buf = SG_CALLOC( char, ctx->buf_len );
+   if( buf == NULL ) {
+      return -ENOMEM;
+   }
+
+   if( existed ) {
+
+      // whatever we skip has to read back as zeros
+      rc = UG_ftruncate( ug, 0, fh );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to truncate '%s': %d %s\n", job->path, rc, strerror(abs(rc)));
+         goto put_sparse_end;
+      }
+   }
+
+   while( off < size ) {
+
+      // next data extent 
+      where = lseek( fd, off, SEEK_DATA );
+      if( where < 0 ) {
+
+         if( errno == ENXIO ) {
+            // only a hole is left
+            break;
+         }
+
+         if( errno != EINVAL ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to seek '%s': %s\n", job->file_path, strerror(-rc));
+            goto put_sparse_end;
+         }
+
+         // can't tell; it's all data
+         where = off;
+         hole = size;
+      }
+      else {
+
+         data = where;
+         where = lseek( fd, data, SEEK_HOLE );
+         if( where < 0 ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to seek '%s': %s\n", job->file_path, strerror(-rc));
+            goto put_sparse_end;
+         }
+
+         hole = where;
+         where = data;
+      }
+
+      data = std::max( off, (uint64_t)where - ((uint64_t)where % bs) );
+      hole = std::min( ((hole + bs - 1) / bs) * bs, size );
+
+      SG_debug("'%s': data at %" PRIu64 "-%" PRIu64 "\n", job->file_path, data, hole );
+
+      for( off = data; off < hole; off += len ) {
+
+         len = std::min( (uint64_t)ctx->buf_len, hole - off );
+
+         nr = pread( fd, buf, len, off );
+         if( nr < 0 && errno == EINTR ) {
+            len = 0;
+            continue;
+         }
+         if( nr <= 0 ) {
+            rc = (nr < 0 ? -errno : -ENODATA);
+            fprintf(stderr, "Failed to read '%s': %s\n", job->file_path, strerror(-rc));
+            goto put_sparse_end;
+         }
+
+         len = nr;
+
+         if( !ctx->opts->detect_zeros ) {
+
+            rc = put_write_at( ug, fh, job->path, buf, len, off, &pos );
+            if( rc != 0 ) {
+               goto put_sparse_end;
+            }
+
+            *written += len;
+            continue;
+         }
+
+         // write each run of nonzero blocks
+         for( uint64_t i = 0; i < len; i = run ) {
+
+            block_len = std::min( bs, len - i );
+            run = i + block_len;
+
+            if( buf_is_zero( buf + i, block_len ) ) {
+               continue;
+            }
+
+            while( run < len && !buf_is_zero( buf + run, std::min( bs, len - run ) ) ) {
+               run += std::min( bs, len - run );
+            }
+
+            rc = put_write_at( ug, fh, job->path, buf + i, run - i, off + i, &pos );
+            if( rc != 0 ) {
+               goto put_sparse_end;
+            }
+
+            *written += run - i;
+         }
+      }
+   }
+
+   // holes at the end 
+   if( pos < size ) {
+
+      rc = UG_ftruncate( ug, size, fh );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to truncate '%s': %d %s\n", job->path, rc, strerror(abs(rc)));
+         goto put_sparse_end;
+      }
+   }
+
+   SG_debug("'%s': wrote %" PRIu64 " of %" PRIu64 " bytes\n", job->path, *written, size );
+
+put_sparse_end:
+
+   SG_safe_free( buf );
+   return rc;
+}
+
+
+/**
+ * @brief Make an upload durable: fsync it, then retire its journal, publish its block hashes, and close it
+ *
+ * @param[in] ctx The upload state
+ * @param[in,out] job The upload; its fsync timings are filled in
+ * @param[in] fh Its open handle (closed)
+ * @param[in] journal Its journal (--resume), or NULL (freed)
+ * @param[in] hashes Its block hashes (--delta), or NULL (freed)
+ * @param[in] sb The local file's metadata
+ * @retval 0 Success
+ * @retval 1 Failure (the reason is printed to stderr)
+ */
+static int put_commit( struct put_ctx* ctx, struct put_job* job, UG_handle_t* fh, struct journal* journal, unsigned char* hashes, struct stat* sb ) {
+
+   int rc = 0;
+   struct UG_state* ug = ctx->ug;
+   char const* path = job->path;
+
+   // sync 
+   clock_gettime( CLOCK_MONOTONIC, &job->ts_begin );
+   rc = UG_fsync( ug, fh );
+   clock_gettime( CLOCK_MONOTONIC, &job->ts_end );
+
+   if( rc < 0 ) {
+
+      fprintf(stderr, "Failed to fsync '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+      UG_close( ug, fh );
+      journal_free( journal );
+      SG_safe_free( hashes );
+      return 1;
+   }
+
+   // all committed; nothing to resume
+   if( journal != NULL ) {
+      journal_remove( journal );
+   }
+
+   if( hashes != NULL ) {
+      put_delta_finish( ctx, job, sb, hashes );
+      SG_safe_free( hashes );
+   }
+
+   if( job->has_digest ) {
+      put_digest_finish( ctx, job );
+   }
+
+   // close 
+   rc = UG_close( ug, fh );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to close '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+      return 1;
+   } 
+
+   return 0;
+}
+
+
+/**
+ * @brief Hand an upload to the committer thread (--group-commit)
+ *
+ * Blocks while GROUP_COMMIT_MAX uploads are already waiting, so handles don't pile up
+ * when fsyncs fall behind.  The committer marks the upload done.
+ */
+static void put_commit_defer( struct put_ctx* ctx, struct put_job* job, UG_handle_t* fh, struct journal* journal, unsigned char* hashes, struct stat* sb ) {
+
+   struct put_committer* committer = ctx->committer;
+   struct put_commit commit;
+
+   commit.job = job;
+   commit.fh = fh;
+   commit.journal = journal;
+   commit.hashes = hashes;
+   commit.sb = *sb;
+
+   pthread_mutex_lock( &ctx->lock );
+
+   while( committer->queue.size() >= GROUP_COMMIT_MAX ) {
+      pthread_cond_wait( &committer->cond, &ctx->lock );
+   }
+
+   committer->queue.push_back( commit );
+
+   pthread_cond_broadcast( &committer->cond );
+   pthread_mutex_unlock( &ctx->lock );
+}
+
+
+/**
+ * @brief Committer thread (--group-commit): fsync and close each upload handed to it, in order,
+ * and mark it done, until told to stop and the queue is empty
+ *
+ * Every upload that is queued is committed, even after a failure, so that everything that
+ * was written is durable by the time the tool exits.
+ *
+ * @param[in] arg The put_ctx
+ * @return NULL
+ */
+static void* put_committer_main( void* arg ) {
+
+   struct put_ctx* ctx = (struct put_ctx*)arg;
+   struct put_committer* committer = ctx->committer;
+   struct put_commit commit;
+   int rc = 0;
+
+   pthread_mutex_lock( &ctx->lock );
+
+   while( true ) {
+
+      while( committer->queue.empty() && !committer->stop ) {
+         pthread_cond_wait( &committer->cond, &ctx->lock );
+      }
+
+      if( committer->queue.empty() ) {
+         break;
+      }
+
+      commit = committer->queue.front();
+      committer->queue.pop_front();
+
+      // room for another
+      pthread_cond_broadcast( &committer->cond );
+      pthread_mutex_unlock( &ctx->lock );
+
+      rc = put_commit( ctx, commit.job, commit.fh, commit.journal, commit.hashes, &commit.sb );
+
+      pthread_mutex_lock( &ctx->lock );
+
+      commit.job->rc = rc;
+      commit.job->done = true;
+      if( rc != 0 ) {
+         ctx->failed = true;
+      }
+
+      pthread_cond_broadcast( &ctx->done_cond );
+   }
+
+   pthread_mutex_unlock( &ctx->lock );
+   return NULL;
+}
+
+
+/**
+ * @brief Start the committer thread (--group-commit)
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_committer_start( struct put_ctx* ctx ) {
+
+   int rc = 0;
+   struct put_committer* committer = NULL;
+
+   committer = SG_safe_new( struct put_committer );
+   if( committer == NULL ) {
+      return -ENOMEM;
+   }
+
+   committer->stop = false;
+   committer->running = false;
+   pthread_cond_init( &committer->cond, NULL );
+
+   ctx->committer = committer;
+
+   rc = pthread_create( &committer->thread, NULL, put_committer_main, ctx );
+   if( rc != 0 ) {
+      return -rc;
+   }
+
+   committer->running = true;
+   return 0;
+}
+
+
+/**
+ * @brief Commit whatever is still queued, then stop and free the committer thread (--group-commit)
+ *
+ * The workers must have stopped.  Safe to call more than once.
+ */
+static void put_committer_stop( struct put_ctx* ctx ) {
+
+   struct put_committer* committer = ctx->committer;
+
+   if( committer == NULL ) {
+      return;
+   }
+
+   if( committer->running ) {
+
+      pthread_mutex_lock( &ctx->lock );
+      committer->stop = true;
+      pthread_cond_broadcast( &committer->cond );
+      pthread_mutex_unlock( &ctx->lock );
+
+      pthread_join( committer->thread, NULL );
+   }
+
+   pthread_cond_destroy( &committer->cond );
+   SG_safe_delete( committer );
+   ctx->committer = NULL;
+}
+
+
+/**
+ * @brief Upload one local file to the volume
+ *
+ * Regular files are mapped and written straight out of the mapping if the
+ * --mmap option is given; everything else goes through the worker's transfer
+ * buffers, which are allocated the first time they are needed.  With --resume,
+ * regular files are committed at checkpoints and pick up after the last one.
+ *
+ * @param[in] ctx The upload state
+ * @param[in,out] job The upload to carry out; its fsync timings are filled in
+ * @param[in,out] pl Transfer buffers owned by the calling worker (*pl may be NULL)
+ * @retval 0 Success
+ * @retval 1 Failure (the reason is printed to stderr)
+ * @retval PUT_COMMIT_PENDING The data is written, and the committer thread will fsync the upload and mark it done (--group-commit)
+ */
+static int put_file( struct put_ctx* ctx, struct put_job* job, struct pipeline** pl ) {
+
+   int rc = 0;
+   struct UG_state* ug = ctx->ug;
+   struct stat sb;
+   int fd = 0;
+   UG_handle_t* fh = NULL;
+   struct pipeline_local local;
+   struct pipeline_ug ugf;
+   struct pipeline_stats stats;
+   struct put_checkpoint cp;
+   struct journal* journal = NULL;
+   struct pipeline* stream_pl = NULL;
+   uint64_t offset = 0;
+   bool stream = false;
+   bool regular = false;
+   bool resume = false;
+   bool delta = false;
+   bool sparse = false;
+   bool existed = false;
+   unsigned char* hashes = NULL;
+   char const* file_path = job->file_path;
+   char const* path = job->path;
+
+   // get the file...
+   stream = (strcmp( file_path, "-" ) == 0);
+   if( stream ) {
+      fd = dup( STDIN_FILENO );
+   }
+   else {
+      fd = open( file_path, O_RDONLY );
+   }
+
+   if( fd < 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
+      return 1;
+   }
+
+   rc = fstat( fd, &sb );
+   if( rc != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to stat '%s': %s\n", file_path, strerror(-rc));
+      close( fd );
+      return 1;
+   }
+
+   // only regular files can be compared block by block, or picked up part way.
+   // stdin is always streamed, even if it is redirected from a file.
+   regular = (S_ISREG( sb.st_mode ) && !stream);
+   delta = (ctx->opts->delta && regular);
+   sparse = ((ctx->opts->sparse || ctx->opts->detect_zeros) && regular && !delta);
+   resume = (ctx->opts->resume && regular && !delta && !sparse);
+
+   if( ctx->opts->skip_unchanged && regular ) {
+
+      // skip the upload if the file in the volume already has these contents
+      job->has_digest = (put_digest_local( ctx, job, &sb, fd, job->digest ) == 0);
+
+      if( job->has_digest && !(ctx->names != NULL && nameset_lookup( ctx->names, path ) == NAMESET_ABSENT) && put_digest_matches( ctx, job, &sb ) ) {
+
+         SG_debug("Skipping '%s': '%s' is unchanged\n", file_path, path );
+         close( fd );
+         return 0;
+      }
+   }
+
+   if( *pl == NULL && !stream && !delta && !sparse && !(ctx->opts->mmap && regular && !resume) ) {
+
+      *pl = pipeline_new( ctx->buf_len, PIPELINE_DEPTH );
+      if( *pl == NULL ) {
+         SG_error("%s", "Out of memory\n");
+         close( fd );
+         return 1;
+      }
+   }
+
+   if( ctx->names != NULL && nameset_lookup( ctx->names, path ) == NAMESET_EXISTS ) {
+
+      // known to exist; don't bother trying to create it
+      fh = UG_open( ug, path, O_WRONLY, &rc );
+      if( rc == 0 ) {
+         existed = true;
+      }
+      else if( rc != -ENOENT ) {
+         fprintf(stderr, "Failed to open '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+         close( fd );
+         return 1;
+      }
+   }
+
+   if( fh == NULL ) {
+
+      // try to create
+      fh = UG_create( ug, path, 0540, &rc );
+      if( rc != 0 ) {
+
+         if( rc != -EEXIST ) { 
+            fprintf(stderr, "Failed to create '%s' (%d): %s\n", path, rc, strerror( abs(rc) ) );
+            close( fd );
+            return 1;
+         }
+         else {
+
+            // already exists.  open
+            existed = true;
+            fh = UG_open( ug, path, O_WRONLY, &rc );
+            if( rc != 0 ) {
+               fprintf(stderr, "Failed to open '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
+               close( fd );
+               return 1;
+            }
+         }
+      }
+   }
+
+   memset( &local, 0, sizeof(struct pipeline_local) );
+   local.fd = fd;
+   ugf.ug = ug;
+   ugf.fh = fh;
+
+   if( delta ) {
+
+      // only send the blocks that changed
+      memset( &stats, 0, sizeof(struct pipeline_stats) );
+      rc = put_delta( ctx, job, &sb, fd, fh, existed, &hashes, &stats.bytes );
+   }
+   else if( sparse ) {
+
+      // skip holes and zeros
+      memset( &stats, 0, sizeof(struct pipeline_stats) );
+      rc = put_sparse( ctx, job, &sb, fd, fh, existed, &stats.bytes );
+   }
+   else if( stream ) {
+
+      // one block per buffer, so each block is written as soon as it arrives.  commit now and then,
+      // so a long stream doesn't pile up uncommitted data.
+      memset( &stats, 0, sizeof(struct pipeline_stats) );
+
+      stream_pl = pipeline_new( ctx->io_size, std::max( (int)((PIPELINE_DEPTH * ctx->buf_len) / ctx->io_size), PIPELINE_DEPTH ) );
+      if( stream_pl == NULL ) {
+         SG_error("%s", "Out of memory\n");
+         rc = -ENOMEM;
+      }
+      else {
+
+         cp.ugf = &ugf;
+         cp.journal = NULL;
+         cp.path = path;
+         cp.pos = 0;
+         cp.committed = 0;
+         cp.interval = ctx->checkpoint;
+
+         rc = pipeline_run( stream_pl, pipeline_fill_local, &local, put_drain_checkpoint, &cp, &stats );
+         pipeline_free( stream_pl );
+      }
+   }
+   else if( resume ) {
+
+      rc = put_resume_begin( ug, job, &sb, fd, fh, &journal, &offset );
+      if( rc != 0 ) {
+         close( fd );
+         UG_close( ug, fh );
+         journal_free( journal );
+         return 1;
+      }
+
+      cp.ugf = &ugf;
+      cp.journal = journal;
+      cp.path = path;
+      cp.pos = offset;
+      cp.committed = offset;
+      cp.interval = ctx->checkpoint;
+
+      // commit as we go
+      rc = pipeline_run( *pl, pipeline_fill_local, &local, put_drain_checkpoint, &cp, &stats );
+   }
+   else if( ctx->opts->mmap && regular ) {
+
+      // write straight out of the page cache
+      rc = pipeline_mmap_run( fd, sb.st_size, 0, ctx->buf_len, pipeline_drain_ug, &ugf, &stats );
+   }
+   else {
+
+      // read the next buffer while the current one is written
+      rc = pipeline_run( *pl, pipeline_fill_local, &local, pipeline_drain_ug, &ugf, &stats );
+   }
+
+   if( job->has_digest ) {
+
+      // the digest is only good if the file didn't change while it was read
+      struct stat sb_after;
+
+      if( fstat( fd, &sb_after ) != 0 || sb_after.st_size != sb.st_size || sb_after.st_mtim.tv_sec != sb.st_mtim.tv_sec || sb_after.st_mtim.tv_nsec != sb.st_mtim.tv_nsec ) {
+         job->has_digest = false;
+      }
+   }
+
+   close( fd );
+
+   if( stats.fill_rc < 0 ) {
+      fprintf(stderr, "Failed to read '%s': %s\n", file_path, strerror(abs(stats.fill_rc)));
+   }
+   if( stats.drain_rc < 0 ) {
+      fprintf(stderr, "Failed to write '%s': %d %s\n", path, stats.drain_rc, strerror(abs(stats.drain_rc)));
+   }
+
+   if( rc < 0 ) {
+      UG_close( ug, fh );
+      journal_free( journal );
+      SG_safe_free( hashes );
+      return 1;
+   }
+
+   SG_debug("Wrote %" PRIu64 " bytes for %s\n", stats.bytes, path );
+
+   if( ctx->committer != NULL ) {
+
+      // fsync and close in the background, while the next upload starts
+      put_commit_defer( ctx, job, fh, journal, hashes, &sb );
+      return PUT_COMMIT_PENDING;
+   }
+
+   return put_commit( ctx, job, fh, journal, hashes, &sb );
+}
+
+
+/**
+ * @brief Upload worker: take the next pair in argument order and upload it, until there are none left or one fails
+ *
+ * Each worker owns its own transfer buffers and file handles; only the UG state is shared.
+ *
+ * @param[in] arg The put_ctx
+ * @return NULL
+ */
+static void* put_worker( void* arg ) {
+
+   struct put_ctx* ctx = (struct put_ctx*)arg;
+   struct put_job* job = NULL;
+   struct pipeline* pl = NULL;
+   int rc = 0;
+
+   while( 1 ) {
+
+      pthread_mutex_lock( &ctx->lock );
+
+      if( ctx->failed || ctx->next_job >= ctx->num_jobs ) {
+         pthread_cond_broadcast( &ctx->done_cond );
+         pthread_mutex_unlock( &ctx->lock );
+         break;
+      }
+
+      job = &ctx->jobs[ ctx->next_job ];
+      ctx->next_job++;
+
+      pthread_mutex_unlock( &ctx->lock );
+
+      rc = put_file( ctx, job, &pl );
+
+      pthread_mutex_lock( &ctx->lock );
+
+      if( rc != PUT_COMMIT_PENDING ) {
+
+         job->rc = rc;
+         job->done = true;
+         if( rc != 0 ) {
+            ctx->failed = true;
+         }
+      }
+
+      pthread_cond_broadcast( &ctx->done_cond );
+      pthread_mutex_unlock( &ctx->lock );
+   }
+
+   pipeline_free( pl );
+   return NULL;
+}
+
+
+/**
+ * @brief Heap order for ready uploads: the largest file comes out first
+ */
+struct put_job_smaller {
+   struct put_job* jobs;
+
+   bool operator()( int a, int b ) const {
+      return jobs[a].size < jobs[b].size;
+   }
+};
+
+
+/**
+ * @brief Join a directory path and a name
+ *
+ * @return The joined path (to be freed), or NULL if out of memory
+ */
+static char* put_path_join( char const* dir, char const* name ) {
+
+   size_t len = strlen(dir);
+   char* ret = SG_CALLOC( char, len + strlen(name) + 2 );
+
+   if( ret == NULL ) {
+      return NULL;
+   }
+
+   if( len > 0 && dir[len-1] == '/' ) {
+      sprintf( ret, "%s%s", dir, name );
+   }
+   else {
+      sprintf( ret, "%s/%s", dir, name );
+   }
+
+   return ret;
+}
+
+
+/**
+ * @brief Free a recursive upload's directories, and the paths its uploads point to
+ *
+ * @param[in] tree The tree (may be NULL)
+ * @param[in] jobs The uploads built with it
+ * @param[in] num_jobs Number of uploads
+ */
+static void put_tree_free( struct put_tree* tree, struct put_job* jobs, int num_jobs ) {
+
+   if( tree == NULL ) {
+      return;
+   }
+
+   for( size_t i = 0; i < tree->dirs.size(); i++ ) {
+      SG_safe_free( tree->dirs[i].file_path );
+      SG_safe_free( tree->dirs[i].path );
+   }
+
+   for( int i = 0; jobs != NULL && i < num_jobs; i++ ) {
+      free( (char*)jobs[i].file_path );
+      free( (char*)jobs[i].path );
+   }
+
+   SG_safe_delete( tree );
+}
+
+
+/**
+ * @brief Walk a local directory tree breadth-first, and plan a recursive upload of it (-r)
+ *
+ * Every directory under file_root becomes a directory under root, and every regular
+ * file becomes an upload.  Symlinks and special files are skipped, with a message.
+ * On success, ctx->tree, ctx->jobs and ctx->num_jobs are set, and the top directory
+ * is ready to be created.
+ *
+ * @param[in,out] ctx The upload state
+ * @param[in] file_root Path to the local directory
+ * @param[in] root Path to the directory in the volume
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int put_tree_build( struct put_ctx* ctx, char const* file_root, char const* root ) {
+
+   int rc = 0;
+   struct put_tree* tree = NULL;
+   struct put_dir dir;
+   struct put_job job;
+   struct stat sb;
+   std::vector<struct put_job> jobs;
+   DIR* dirp = NULL;
+   struct dirent* dent = NULL;
+
+   if( stat( file_root, &sb ) != 0 ) {
+      rc = -errno;
+      fprintf(stderr, "Failed to stat '%s': %s\n", file_root, strerror(-rc));
+      return rc;
+   }
+
+   if( !S_ISDIR( sb.st_mode ) ) {
+      fprintf(stderr, "'%s' is not a directory\n", file_root );
+      return -ENOTDIR;
+   }
+
+   tree = SG_safe_new( struct put_tree );
+   if( tree == NULL ) {
+      return -ENOMEM;
+   }
+
+   tree->mkdirs_running = 0;
+
+   dir.file_path = SG_strdup_or_null( file_root );
+   dir.path = SG_strdup_or_null( root );
+   dir.mode = sb.st_mode & 0777;
+   tree->dirs.push_back( dir );
+
+   if( dir.file_path == NULL || dir.path == NULL ) {
+      rc = -ENOMEM;
+      goto put_tree_build_end;
+   }
+
+   // breadth-first: dirs doubles as the queue of directories to list
+   for( size_t i = 0; i < tree->dirs.size(); i++ ) {
+
+      dirp = opendir( tree->dirs[i].file_path );
+      if( dirp == NULL ) {
+         rc = -errno;
+         fprintf(stderr, "Failed to open '%s': %s\n", tree->dirs[i].file_path, strerror(-rc));
+         goto put_tree_build_end;
+      }
+
+      while( true ) {
+
+         errno = 0;
+         dent = readdir( dirp );
+         if( dent == NULL ) {
+
+            rc = -errno;
+            if( rc != 0 ) {
+               fprintf(stderr, "Failed to read '%s': %s\n", tree->dirs[i].file_path, strerror(-rc));
+            }
+            break;
+         }
+
+         if( strcmp( dent->d_name, "." ) == 0 || strcmp( dent->d_name, ".." ) == 0 ) {
+            continue;
+         }
+
+         // journals and hash caches stay local
+         if( put_is_sidecar( dent->d_name ) ) {
+            continue;
+         }
+
+         if( fstatat( dirfd( dirp ), dent->d_name, &sb, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+            rc = -errno;
+            fprintf(stderr, "Failed to stat '%s/%s': %s\n", tree->dirs[i].file_path, dent->d_name, strerror(-rc));
+            break;
+         }
+
+         if( S_ISDIR( sb.st_mode ) ) {
+
+            dir.file_path = put_path_join( tree->dirs[i].file_path, dent->d_name );
+            dir.path = put_path_join( tree->dirs[i].path, dent->d_name );
+            dir.mode = sb.st_mode & 0777;
+
+            tree->dirs[i].dirs.push_back( tree->dirs.size() );
+            tree->dirs.push_back( dir );
+
+            if( dir.file_path == NULL || dir.path == NULL ) {
+               rc = -ENOMEM;
+               break;
+            }
+         }
+         else if( S_ISREG( sb.st_mode ) ) {
+
+            memset( &job, 0, sizeof(struct put_job) );
+            job.file_path = put_path_join( tree->dirs[i].file_path, dent->d_name );
+            job.path = put_path_join( tree->dirs[i].path, dent->d_name );
+            job.size = sb.st_size;
+
+            tree->dirs[i].files.push_back( jobs.size() );
+            jobs.push_back( job );
+
+            if( job.file_path == NULL || job.path == NULL ) {
+               rc = -ENOMEM;
+               break;
+            }
+         }
+         else {
+            fprintf(stderr, "Skipping '%s/%s': not a regular file or directory\n", tree->dirs[i].file_path, dent->d_name );
+         }
+      }
+
+      closedir( dirp );
+
+      if( rc != 0 ) {
+         goto put_tree_build_end;
+      }
+   }
+
+   ctx->jobs = SG_CALLOC( struct put_job, jobs.size() + 1 );
+   if( ctx->jobs == NULL ) {
+      rc = -ENOMEM;
+      goto put_tree_build_end;
+   }
+
+   if( jobs.size() > 0 ) {
+      memcpy( ctx->jobs, &jobs[0], jobs.size() * sizeof(struct put_job) );
+   }
+
+   ctx->num_jobs = jobs.size();
+   ctx->tree = tree;
+
+   // the top directory needs no parent
+   tree->mkdirs.push_back( 0 );
+
+   SG_debug("'%s': %zu directories, %zu files\n", file_root, tree->dirs.size(), jobs.size() );
+
+put_tree_build_end:
+
+   if( rc != 0 ) {
+      put_tree_free( tree, (jobs.size() > 0 ? &jobs[0] : NULL), jobs.size() );
+   }
+
+   return rc;
+}
+
+
+/**
+ * @brief Recursive upload worker (-r): create the next directory, or else upload the largest file whose
+ * directory exists, until everything is done or something fails
+ *
+ * Directories come first, since each one may make more files ready.  A worker with nothing
+ * to do waits while other workers are still creating directories.
+ *
+ * @param[in] arg The put_ctx
+ * @return NULL
+ */
+static void* put_tree_worker( void* arg ) {
+
+   struct put_ctx* ctx = (struct put_ctx*)arg;
+   struct put_tree* tree = ctx->tree;
+   struct put_job_smaller smaller;
+   struct put_dir* dir = NULL;
+   struct pipeline* pl = NULL;
+   int idx = 0;
+   int rc = 0;
+
+   smaller.jobs = ctx->jobs;
+
+   pthread_mutex_lock( &ctx->lock );
+
+   while( !ctx->failed ) {
+
+      if( !tree->mkdirs.empty() ) {
+
+         idx = tree->mkdirs.front();
+         tree->mkdirs.pop_front();
+         tree->mkdirs_running++;
+
+         dir = &tree->dirs[idx];
+
+         pthread_mutex_unlock( &ctx->lock );
+
+         rc = UG_mkdir( ctx->ug, dir->path, dir->mode );
+         if( rc == -EEXIST ) {
+
+            // fill in an existing directory
+            rc = 0;
+         }
+
+         if( rc != 0 ) {
+            fprintf(stderr, "Failed to mkdir '%s': %d %s\n", dir->path, rc, strerror( abs(rc) ) );
+         }
+
+         pthread_mutex_lock( &ctx->lock );
+
+         tree->mkdirs_running--;
+
+         if( rc != 0 ) {
+            ctx->failed = true;
+         }
+         else {
+
+            // its subdirectories and files can go now
+            for( size_t i = 0; i < dir->dirs.size(); i++ ) {
+               tree->mkdirs.push_back( dir->dirs[i] );
+            }
+
+            for( size_t i = 0; i < dir->files.size(); i++ ) {
+               tree->ready.push_back( dir->files[i] );
+               std::push_heap( tree->ready.begin(), tree->ready.end(), smaller );
+            }
+         }
+
+         pthread_cond_broadcast( &ctx->done_cond );
+      }
+      else if( !tree->ready.empty() ) {
+
+         std::pop_heap( tree->ready.begin(), tree->ready.end(), smaller );
+         idx = tree->ready.back();
+         tree->ready.pop_back();
+
+         pthread_mutex_unlock( &ctx->lock );
+
+         rc = put_file( ctx, &ctx->jobs[idx], &pl );
+
+         pthread_mutex_lock( &ctx->lock );
+
+         if( rc != PUT_COMMIT_PENDING ) {
+
+            ctx->jobs[idx].rc = rc;
+            ctx->jobs[idx].done = true;
+            if( rc != 0 ) {
+               ctx->failed = true;
+            }
+         }
+
+         pthread_cond_broadcast( &ctx->done_cond );
+      }
+      else if( tree->mkdirs_running > 0 ) {
+
+         // a directory being created may make more work
+         pthread_cond_wait( &ctx->done_cond, &ctx->lock );
+      }
+      else {
+
+         // all done
+         break;
+      }
+   }
+
+   pthread_cond_broadcast( &ctx->done_cond );
+   pthread_mutex_unlock( &ctx->lock );
+
+   pipeline_free( pl );
+   return NULL;
+}
+
 
 /**
  * @brief syndicate-put entry point
@@ -37,18 +1687,14 @@ int main( int argc, char** argv ) {
    int rc = 0;
    struct UG_state* ug = NULL;
    struct SG_gateway* gateway = NULL;
-   char* path = NULL;
    int path_optind = 0;
-   char* file_path = NULL;
-   int fd = 0;
-   char* buf = NULL;
-   ssize_t nr = 0;
-   ssize_t total = 0;
-   UG_handle_t* fh = NULL;
+   struct put_ctx ctx;
+   pthread_t* threads = NULL;
+   int num_threads = 0;
+   int num_stdin = 0;
+   char const** paths = NULL;
 
    int t = 0;
-   struct timespec ts_begin;
-   struct timespec ts_end;
    int64_t* times = NULL;
 
    mode_t um = umask(0);
@@ -57,11 +1703,13 @@ int main( int argc, char** argv ) {
    struct tool_opts opts;
    
    memset( &opts, 0, sizeof(tool_opts) );
+   memset( &ctx, 0, sizeof(struct put_ctx) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, TOOL_OPT_JOBS | TOOL_OPT_RECURSIVE | TOOL_OPT_MMAP | TOOL_OPT_IO_SIZE | TOOL_OPT_RESUME | TOOL_OPT_CHECKPOINT | TOOL_OPT_DELTA | TOOL_OPT_SPARSE | TOOL_OPT_DETECT_ZEROS | TOOL_OPT_GROUP_COMMIT | TOOL_OPT_SKIP_UNCHANGED );
    if( argc < 0 ) {
       
-      usage( argv[0], "local_file syndicate_file [local_file syndicate_file...]" );
+      usage( argv[0], "[-j|--jobs N] [--mmap] [--io-size SIZE] [--resume [--checkpoint SIZE]] [--delta] [--sparse] [--detect-zeros] [--group-commit] [--skip-unchanged] local_file syndicate_file [local_file syndicate_file...]" );
+      usage( argv[0], "-r|--recursive [-j|--jobs N] [OPTION]... local_dir syndicate_dir" );
       md_common_usage();
       exit(1);
    }
@@ -78,141 +1726,208 @@ int main( int argc, char** argv ) {
    
    // get the path...
    path_optind = SG_gateway_first_arg_optind( gateway );
-   if( path_optind == argc || ((argc - path_optind) % 2) != 0 ) {
+   if( path_optind == argc || ((argc - path_optind) % 2) != 0 || (opts.recursive && argc - path_optind != 2) ) {
       
-      usage( argv[0], "local_file syndicate_file[ local_file syndicate_file]" );
+      usage( argv[0], "[-j|--jobs N] [--mmap] [--io-size SIZE] [--resume [--checkpoint SIZE]] [--delta] [--sparse] [--detect-zeros] [--group-commit] [--skip-unchanged] local_file syndicate_file[ local_file syndicate_file]" );
+      usage( argv[0], "-r|--recursive [-j|--jobs N] [OPTION]... local_dir syndicate_dir" );
       UG_shutdown( ug );
       exit(1);
    }
-    
-   if( opts.benchmark ) {
-      times = SG_CALLOC( int64_t, (argc - path_optind) / 2 + 1 );
-      if( times == NULL ) {
-          UG_shutdown( ug );
-          SG_error("%s", "Out of memory\n");
-          exit(1);
+
+   ctx.ug = ug;
+   ctx.opts = &opts;
+   ctx.io_size = get_io_size( ug, &opts );
+   ctx.buf_len = io_align( BUF_SIZE, ctx.io_size );
+   ctx.hash_threads = std::max( (int)sysconf( _SC_NPROCESSORS_ONLN ), 1 );
+
+   // checkpoints fall on buffer boundaries, so they are I/O unit-aligned
+   ctx.checkpoint = (opts.checkpoint > 0 ? opts.checkpoint : CHECKPOINT_SIZE);
+   ctx.checkpoint = std::max( ctx.checkpoint - (ctx.checkpoint % ctx.buf_len), (uint64_t)ctx.buf_len );
+
+   if( opts.recursive ) {
+
+      // plan the whole tree; directories count as work too
+      rc = put_tree_build( &ctx, argv[path_optind], argv[path_optind + 1] );
+      if( rc != 0 ) {
+         UG_shutdown( ug );
+         exit(1);
       }
+
+      num_threads = std::max( opts.jobs, 1 );
    }
+   else {
 
-   buf = SG_CALLOC( char, BUF_SIZE );
-   if( buf == NULL ) {
+      ctx.num_jobs = (argc - path_optind) / 2;
+      ctx.jobs = SG_CALLOC( struct put_job, ctx.num_jobs );
+      if( ctx.jobs == NULL ) {
+         UG_shutdown( ug );
+         SG_error("%s", "Out of memory\n");
+         exit(1);
+      }
+
+      for( int i = 0; i < ctx.num_jobs; i++ ) {
+
+         // get the file path...
+         ctx.jobs[i].file_path = argv[path_optind + 2*i];
+
+         // get the syndicate path...
+         ctx.jobs[i].path = argv[path_optind + 2*i + 1];
+
+         if( strcmp( ctx.jobs[i].file_path, "-" ) == 0 ) {
+            num_stdin++;
+         }
+      }
+
+      if( num_stdin > 1 ) {
+         fprintf(stderr, "Only one upload can read from stdin\n");
+         UG_shutdown( ug );
+         SG_safe_free( ctx.jobs );
+         exit(1);
+      }
+
+      num_threads = std::min( std::max( opts.jobs, 1 ), ctx.num_jobs );
+   }
+
+   // find out which files already exist, a directory at a time.
+   // not with -r: that would list the whole tree before any upload starts, and files in
+   // directories that -r just created can't exist anyway (creates fall back on -EEXIST).
+   if( ctx.tree == NULL ) {
+      paths = SG_CALLOC( char const*, ctx.num_jobs + 1 );
+   }
+
+   if( paths != NULL ) {
+
+      for( int i = 0; i < ctx.num_jobs; i++ ) {
+         paths[i] = ctx.jobs[i].path;
+      }
+
+      nameset_build( ug, paths, ctx.num_jobs, &ctx.names );
+      SG_safe_free( paths );
+   }
+
+   threads = SG_CALLOC( pthread_t, num_threads );
+
+   if( opts.benchmark ) {
+      times = SG_CALLOC( int64_t, ctx.num_jobs + 1 );
+   }
+
+   if( threads == NULL || (opts.benchmark && times == NULL) ) {
       UG_shutdown( ug );
+      put_tree_free( ctx.tree, ctx.jobs, ctx.num_jobs );
+      nameset_free( ctx.names );
+      SG_safe_free( ctx.jobs );
+      SG_safe_free( threads );
+      SG_safe_free( times );
       SG_error("%s", "Out of memory\n");
       exit(1);
    }
 
-   for( int i = path_optind; i < argc; i += 2 ) {
+   pthread_mutex_init( &ctx.lock, NULL );
+   pthread_cond_init( &ctx.done_cond, NULL );
 
-       total = 0;
+   if( opts.group_commit ) {
 
-       // get the file path...
-       file_path = argv[i];
-    
-       // get the syndicate path...
-       path = argv[i+1];
-
-       // get the file...
-       fd = open( file_path, O_RDONLY );
-       if( fd < 0 ) {
-          rc = -errno;
-          fprintf(stderr, "Failed to open '%s': %s\n", file_path, strerror(-rc));
-          rc = 1;
-          goto put_end;
-       }
-    
-       // try to create
-       fh = UG_create( ug, path, 0540, &rc );
-       if( rc != 0 ) {
-        
-          if( rc != -EEXIST ) { 
-              fprintf(stderr, "Failed to create '%s' (%d): %s\n", path, rc, strerror( abs(rc) ) );
-              rc = 1;
-              goto put_end;
-          }
-          else {
-         
-             // already exists.  open
-             fh = UG_open( ug, path, O_WRONLY, &rc );
-             if( rc != 0 ) {
-                fprintf(stderr, "Failed to open '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
-                rc = 1;
-                goto put_end;
-             }
-          }
-       }
-
-       while( 1 ) {
-          nr = read( fd, buf, BUF_SIZE );
-          if( nr == 0 ) {
-             break;
-          }
-          if( nr < 0 ) {
-             rc = -errno;
-             fprintf(stderr, "Failed to read '%s': %s\n", file_path, strerror(abs(rc)));
-             break;
-          }
-
-          rc = UG_write( ug, buf, nr, fh );
-          if( rc < 0 ) {
-             fprintf(stderr, "Failed to write '%s': %d %s\n", path, rc, strerror(abs(rc)));
-             break;
-          }
-
-          total += nr;
-       }
-
-       close( fd );
-
-       if( rc < 0 ) {
-          rc = 1;
-          goto put_end;
-       }
-
-       // sync 
-       clock_gettime( CLOCK_MONOTONIC, &ts_begin );
-       rc = UG_fsync( ug, fh );
-       clock_gettime( CLOCK_MONOTONIC, &ts_end );
-
-       if( rc < 0 ) {
-         
-          fprintf(stderr, "Failed to fsync '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
-          rc = 1;
-          goto put_end;
-       }
-
-       // close 
-       rc = UG_close( ug, fh );
-       if( rc != 0 ) {
-          fprintf(stderr, "Failed to close '%s': %d %s\n", path, rc, strerror( abs(rc) ) );
-          rc = 1;
-          goto put_end;
-       } 
-
-       if( times != NULL ) {
-          printf("\n%ld.%ld - %ld.%ld = %ld\n", ts_end.tv_sec, ts_end.tv_nsec, ts_begin.tv_sec, ts_begin.tv_nsec, md_timespec_diff_ms( &ts_end, &ts_begin ));
-          times[t] = md_timespec_diff_ms( &ts_end, &ts_begin );
-          t++;
-       }
-
-       SG_debug("Wrote %zd bytes for %s\n", total, path );
+      // fsyncs run behind the writes
+      rc = put_committer_start( &ctx );
+      if( rc != 0 ) {
+         fprintf(stderr, "Failed to start commit thread: %s\n", strerror(-rc));
+         rc = 1;
+         num_threads = 0;
+         goto put_end;
+      }
+   }
+
+   num_threads = start_threads( threads, num_threads, (ctx.tree != NULL ? put_tree_worker : put_worker), &ctx );
+   if( num_threads < 0 ) {
+      fprintf(stderr, "Failed to start upload threads: %s\n", strerror(-num_threads));
+      rc = 1;
+      num_threads = 0;
+      goto put_end;
+   }
+
+   if( ctx.tree != NULL ) {
+
+      // uploads finish in size order, not argument order; report the ones that finished
+      join_threads( threads, num_threads );
+      num_threads = 0;
+
+      put_committer_stop( &ctx );
+
+      rc = (ctx.failed ? 1 : 0);
+
+      for( int i = 0; times != NULL && i < ctx.num_jobs; i++ ) {
+
+         if( ctx.jobs[i].done && ctx.jobs[i].rc == 0 ) {
+            struct timespec* ts_begin = &ctx.jobs[i].ts_begin;
+            struct timespec* ts_end = &ctx.jobs[i].ts_end;
+
+            printf("\n%ld.%ld - %ld.%ld = %ld\n", ts_end->tv_sec, ts_end->tv_nsec, ts_begin->tv_sec, ts_begin->tv_nsec, md_timespec_diff_ms( ts_end, ts_begin ));
+            times[t] = md_timespec_diff_ms( ts_end, ts_begin );
+            t++;
+         }
+      }
+
+      goto put_end;
+   }
+
+   // report each upload in argument order, as soon as it and its predecessors finish.
+   // stop at the first failure, just as if the uploads had run one at a time.
+   for( int i = 0; i < ctx.num_jobs; i++ ) {
+
+      pthread_mutex_lock( &ctx.lock );
+
+      // a job that was never handed out will never finish
+      while( !ctx.jobs[i].done && !(ctx.failed && i >= ctx.next_job) ) {
+         pthread_cond_wait( &ctx.done_cond, &ctx.lock );
+      }
+
+      pthread_mutex_unlock( &ctx.lock );
+
+      if( !ctx.jobs[i].done || ctx.jobs[i].rc != 0 ) {
+         rc = 1;
+         break;
+      }
+
+      if( times != NULL ) {
+         struct timespec* ts_begin = &ctx.jobs[i].ts_begin;
+         struct timespec* ts_end = &ctx.jobs[i].ts_end;
+
+         printf("\n%ld.%ld - %ld.%ld = %ld\n", ts_end->tv_sec, ts_end->tv_nsec, ts_begin->tv_sec, ts_begin->tv_nsec, md_timespec_diff_ms( ts_end, ts_begin ));
+         times[t] = md_timespec_diff_ms( ts_end, ts_begin );
+         t++;
+      }
    }
 
 put_end:
 
+   join_threads( threads, num_threads );
+
+   // everything written is durable before exit; a late fsync failure still fails the run
+   put_committer_stop( &ctx );
+   if( ctx.failed ) {
+      rc = 1;
+   }
+
    UG_shutdown( ug );
-   SG_safe_free( buf );
 
-   if( times != NULL ) {
+   pthread_mutex_destroy( &ctx.lock );
+   pthread_cond_destroy( &ctx.done_cond );
+   put_tree_free( ctx.tree, ctx.jobs, ctx.num_jobs );
+   nameset_free( ctx.names );
+   SG_safe_free( ctx.jobs );
+   SG_safe_free( threads );
+
+   if( times != NULL && t > 0 ) {
     
       printf("@@@@@");
       for( int i = 0; i < t - 1; i++ ) {
          printf("%" PRId64 ",", times[i] );
       }
       printf("%" PRId64 "@@@@@\n", times[t-1] );
-
-      SG_safe_free( times );
    }
 
+   SG_safe_free( times );
+
    if( rc != 0 ) {
       exit(1);
    }
@@ -39,6 +39,44 @@
  * @section description DESCRIPTION
  * Put or copy FILE(s) from the local filesystem to the syndicate volume
  *
+ * Before uploading, each directory in the volume that two or more of the files go into is listed once, so that files which already exist are opened directly instead of after a failed create.  This is skipped with -r, so uploads start as soon as their directories exist.
+ *
+ * A FILE of - is read from standard input, which may be a pipe (e.g. pg_dump | syndicate-put - /backups/db.sql).  The stream is written one block (I/O unit) at a time, as soon as each block has been read, and is fsynced every checkpoint (see --checkpoint), so nothing has to be staged on local disk first.  Only one FILE can be -.  --resume, --delta, --sparse and --mmap do not apply to it.
+ *
+ * @section options OPTIONS
+ * -j, --jobs N\n
+ * Upload up to N files at once, each with its own file handle.  Timings and the exit status are still reported in argument order.
+ *
+ * -r, --recursive\n
+ * Copy the local directory tree LOCAL_DIR into the volume as SYNDICATE_DIR (syndicate-put -r LOCAL_DIR SYNDICATE_DIR).  Directories are created breadth-first, and existing ones are filled in.  The workers (see -j) create directories before anything else, and upload each file as soon as its directory exists, largest file first, so the biggest files start early and the small ones fill in at the end.  Symlinks and special files are skipped.  Timings are reported for the files that were uploaded, in no particular order.
+ *
+ * --mmap\n
+ * Map regular local files into memory and write them to the volume straight from the mapping, instead of reading them into buffers first.  Pipes and other special files are still read into buffers.
+ *
+ * --io-size SIZE\n
+ * Write to Syndicate in whole multiples of SIZE bytes (K, M and G suffixes are allowed).  The default is the volume's block size.
+ *
+ * --resume\n
+ * Commit each upload as it goes: every checkpoint, fsync the file in the volume and record how far it got in a journal next to the local file (FILE.sg-journal).  If the upload is interrupted, running the same command again with --resume skips the committed part, as long as the local file and the file in the volume have not changed since.  The journal is removed once the upload is complete.  Pipes and other special files are always uploaded from the start, and regular files are read into buffers even with --mmap.
+ *
+ * --checkpoint SIZE\n
+ * With --resume, and for uploads from standard input, commit the upload every SIZE bytes (K, M and G suffixes are allowed).  SIZE is rounded down to a whole number of transfer buffers.  The default is 256M.
+ *
+ * --delta\n
+ * If the file already exists in the volume, only write the blocks that differ from it, and truncate it if the local file is shorter.  Both copies are hashed block by block (SHA-256, one block per I/O unit) on as many threads as there are CPUs.  The hashes of what was uploaded are kept next to the local file (FILE.sg-blocks) and in the user.syndicate.blockhash xattr of the file in the volume, so the next --delta upload (or syndicate-get --update) does not need to read the file in the volume unless something else wrote to it in between.  Pipes and other special files are uploaded in full.  --resume does not apply to files uploaded with --delta.
+ *
+ * --sparse\n
+ * Only upload the data in sparse local files, skipping their holes (found with SEEK_DATA and SEEK_HOLE), and set the size of the file in the volume at the end.  A file that already exists in the volume is truncated first, so the holes read back as zeros.  Pipes and other special files are uploaded in full.  Ignored with --delta, and --resume does not apply.
+ *
+ * --detect-zeros\n
+ * Like --sparse, but also skip the blocks (one I/O unit each) that are all zeros, even if they are not holes in the local file.
+ *
+ * --group-commit\n
+ * Don't wait for each upload's fsync before starting the next one.  Once a file's data is written, its fsync and close are handed to a background thread, which commits uploads in the order they were written, and the worker goes on to the next file.  Up to 64 uploads can be waiting at once.  Timings and the exit status are still reported per file once its fsync finishes, and everything is fsynced before the tool exits, so a failed fsync still makes the tool exit nonzero.
+ *
+ * --skip-unchanged\n
+ * Don't upload regular files whose contents the file in the volume already has.  Each local file is digested (SHA-256 over the SHA-256 hashes of its 4M blocks, which are hashed on as many threads as there are CPUs).  The digest is compared with the one in the user.syndicate.digest xattr of the file in the volume, which is only trusted if nothing has written to the file since it was published.  The local digest is cached next to the file (FILE.sg-digest) and reused as long as the file's inode, modification time and size are the same.  Every file that is uploaded gets its digest published once it is fsynced, so the first run uploads everything and later runs skip what didn't change.  With -r, the .sg-digest, .sg-blocks and .sg-journal files next to local files are never uploaded.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -67,6 +105,18 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <pthread.h>
+
 #include "common.h"
+#include "pipeline.h"
+#include "journal.h"
+#include "blockhash.h"
+#include "nameset.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 #endif
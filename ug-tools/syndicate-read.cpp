@@ -28,6 +28,865 @@
 
 #define BUF_LEN 1024000
 
+/**
+ * @brief A requested range of a file, in argument order
+ */
+struct read_range {
+   char* path;                     ///< Path to the file
+   uint64_t offset;                ///< Offset of the first byte to print
+   uint64_t len;                   ///< Number of bytes to print
+   size_t extent;                  ///< Index of the extent that covers it (--vectored)
+};
+
+/**
+ * @brief An I/O unit-aligned stretch of a file that covers one or more nearby ranges (--vectored)
+ */
+struct read_extent {
+   size_t file;                    ///< Index of the file
+   uint64_t offset;                ///< Offset in the file
+   uint64_t len;                   ///< Length; extents longer than the buffer are never merged, and are streamed
+   int refs;                       ///< Ranges in the extent that have not been printed yet
+   bool fetched;                   ///< Whether data holds the extent's bytes
+   char* data;                     ///< The extent's bytes, once fetched
+   uint64_t data_len;              ///< Bytes fetched (less than len at EOF)
+};
+
+/**
+ * @brief A file open for --vectored reads
+ */
+struct read_file {
+   char* path;                     ///< Path to the file
+   UG_handle_t* fh;                ///< Handle, opened when first needed
+};
+
+/**
+ * @brief Where the ranges go
+ */
+struct read_sink {
+   char const* path;               ///< Path to the output file (--output)
+   int fd;                         ///< Output file descriptor; if negative, ranges are printed to stdout in order
+};
+
+/**
+ * @brief State shared by the main thread and the fetch workers (-j)
+ *
+ * Workers fetch extents in the order they are first needed, and the main thread prints
+ * them in argument order.  Fetched extents wait in memory until they are printed, up to
+ * limit bytes; a worker may always fetch the extent that the main thread is waiting for.
+ * With --output there is no order to keep, so workers write their extents out themselves.
+ */
+struct read_parallel_ctx {
+   struct UG_state* ug;                        ///< The UG state
+   std::vector<struct read_range>* ranges;     ///< Ranges, in argument order
+   std::vector<struct read_extent>* extents;   ///< Extents to fetch
+   std::vector<struct read_file>* files;       ///< Files the extents are in
+   std::vector< std::vector<size_t> > extent_ranges; ///< Ranges in each extent, for workers that write to --output themselves
+   struct read_sink* sink;                     ///< Where the ranges go
+   std::vector<size_t> order;                  ///< Extent indexes, in the order they are first needed
+   size_t next;                                ///< Index into order of the next extent to fetch
+   uint64_t used;                              ///< Bytes of extents being fetched or waiting to be printed
+   uint64_t limit;                             ///< Most bytes of extents to hold at once
+   ssize_t waiting_for;                        ///< The extent the main thread is waiting for, or -1
+   bool stop;                                  ///< Set when the main thread is done
+   int rc;                                     ///< The first fetch error
+   pthread_mutex_t lock;                       ///< Guards everything above
+   pthread_cond_t cond;                        ///< Signaled when an extent is fetched or freed
+};
+
+
+/**
+ * @brief Print part of a range to stdout, or write it at its offset in the output file
+ *
+ * @param[in] offset The offset of buf in the Syndicate file
+ * @retval 0 Success
+ * @retval -errno Failed to write to the output file
+ */
+static int read_emit( struct read_sink* sink, char const* buf, uint64_t offset, uint64_t len ) {
+
+   ssize_t nw = 0;
+
+   char debug_buf[52];
+
+   memset(debug_buf, 0, 52);
+   for( uint64_t j = 0; j < (50 / 3) && j < len; j++ ) {
+      char nbuf[5];
+      memset(nbuf, 0, 5);
+      snprintf(nbuf, 4, " %02X", buf[j]);
+      strcat(debug_buf, nbuf);
+   }
+
+   SG_debug("Read %" PRIu64 " bytes at %" PRIu64 " (%s...)\n", len, offset, debug_buf );
+
+   if( sink->fd < 0 ) {
+
+      fwrite( buf, 1, len, stdout );
+      return 0;
+   }
+
+   while( len > 0 ) {
+
+      nw = pwrite( sink->fd, buf, len, offset );
+      if( nw < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         nw = -errno;
+         fprintf(stderr, "Failed to write '%s': %s\n", sink->path, strerror(-nw));
+         return nw;
+      }
+
+      buf += nw;
+      offset += nw;
+      len -= nw;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Read whole I/O units from the start of the unit that holds offset, and print only the requested bytes
+ *
+ * @retval 0 Success, or EOF
+ * @retval -errno Failure
+ */
+static int read_stream( struct UG_state* ug, UG_handle_t* fh, char const* path, uint64_t offset, uint64_t len, char* buf, size_t buf_len, uint64_t io_size, struct read_sink* sink ) {
+
+   int rc = 0;
+   uint64_t pos = offset - (offset % io_size);
+   uint64_t end = offset + len;
+   uint64_t want = 0;
+   uint64_t lo = 0;
+   uint64_t hi = 0;
+   ssize_t nr = 0;
+
+   // try to seek to the start of the I/O unit that holds offset
+   UG_seek( fh, pos, SEEK_SET );
+
+   while( pos < end ) {
+
+      want = std::min( ((end - pos + io_size - 1) / io_size) * io_size, (uint64_t)buf_len );
+
+      nr = UG_read( ug, buf, want, fh );
+      if( nr < 0 ) {
+
+         fprintf(stderr, "%s: read: %s\n", path, strerror(-nr));
+         return nr;
+      }
+      if( nr == 0 ) {
+
+         // EOF
+         SG_debug("EOF on %s\n", path ); 
+         break;
+      }
+
+      lo = std::max( pos, offset );
+      hi = std::min( pos + nr, end );
+
+      if( lo < hi ) {
+
+         rc = read_emit( sink, buf + (lo - pos), lo, hi - lo );
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+
+      pos += nr;
+   }
+
+   fflush( stdout );
+   return 0;
+}
+
+
+/**
+ * @brief Read len bytes at offset into data, stopping early at EOF
+ *
+ * @param[out] data_len Bytes read
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int read_fetch( struct UG_state* ug, UG_handle_t* fh, char* data, uint64_t offset, uint64_t len, uint64_t* data_len ) {
+
+   ssize_t nr = 0;
+
+   *data_len = 0;
+
+   UG_seek( fh, offset, SEEK_SET );
+
+   while( *data_len < len ) {
+
+      nr = UG_read( ug, data + *data_len, len - *data_len, fh );
+      if( nr < 0 ) {
+         return nr;
+      }
+      if( nr == 0 ) {
+         break;
+      }
+
+      *data_len += nr;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Order indexes into a list of ranges by range offset
+ */
+struct read_range_offset_cmp {
+
+   std::vector<struct read_range>* ranges;
+
+   read_range_offset_cmp( std::vector<struct read_range>* r ) : ranges( r ) {}
+
+   bool operator()( size_t a, size_t b ) const {
+      return (*ranges)[a].offset < (*ranges)[b].offset;
+   }
+};
+
+
+/**
+ * @brief Sort one file's ranges by offset, and merge those that overlap or are within gap bytes of each other into extents
+ *
+ * @param[in] file Index of the file
+ * @param[in] merge_ranges If false, give each range an extent of its own
+ * @param[in] idx Indexes into ranges of the file's ranges
+ */
+static void read_plan_extents( size_t file, std::vector<size_t>& idx, std::vector<struct read_range>& ranges, std::vector<struct read_extent>& extents, bool merge_ranges, uint64_t gap, uint64_t io_size, size_t buf_len ) {
+
+   struct read_extent ext;
+   uint64_t start = 0;
+   uint64_t end = 0;
+   uint64_t merged_end = 0;
+   bool merge = false;
+
+   std::stable_sort( idx.begin(), idx.end(), read_range_offset_cmp( &ranges ) );
+
+   for( size_t i = 0; i < idx.size(); i++ ) {
+
+      struct read_range* r = &ranges[ idx[i] ];
+
+      start = r->offset - (r->offset % io_size);
+      end = ((r->offset + r->len + io_size - 1) / io_size) * io_size;
+
+      merge = false;
+      if( merge_ranges && i > 0 ) {
+
+         struct read_extent* last = &extents.back();
+
+         // only merge into extents that will still fit into the buffer
+         merged_end = std::max( last->offset + last->len, end );
+         merge = (start <= last->offset + last->len + gap && merged_end - last->offset <= buf_len);
+
+         if( merge ) {
+            last->len = merged_end - last->offset;
+            last->refs++;
+         }
+      }
+
+      if( !merge ) {
+
+         memset( &ext, 0, sizeof(struct read_extent) );
+         ext.file = file;
+         ext.offset = start;
+         ext.len = end - start;
+         ext.refs = 1;
+
+         extents.push_back( ext );
+      }
+
+      r->extent = extents.size() - 1;
+   }
+}
+
+
+/**
+ * @brief Group the ranges by file, and give each range an extent
+ *
+ * @param[in] merge If true, merge nearby ranges into shared extents (--vectored); otherwise each range gets its own
+ */
+static void read_plan( std::vector<struct read_range>& ranges, bool merge, uint64_t gap, uint64_t io_size, size_t buf_len, std::vector<struct read_file>& files, std::vector<struct read_extent>& extents ) {
+
+   std::map<std::string, size_t> file_index;
+   std::map<std::string, size_t>::iterator itr;
+   std::vector< std::vector<size_t> > file_ranges;
+   struct read_file file;
+
+   // group the ranges by file
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      itr = file_index.find( std::string(ranges[i].path) );
+      if( itr == file_index.end() ) {
+
+         file.path = ranges[i].path;
+         file.fh = NULL;
+
+         itr = file_index.insert( std::make_pair( std::string(ranges[i].path), files.size() ) ).first;
+         files.push_back( file );
+         file_ranges.push_back( std::vector<size_t>() );
+      }
+
+      file_ranges[ itr->second ].push_back( i );
+   }
+
+   for( size_t f = 0; f < files.size(); f++ ) {
+      read_plan_extents( f, file_ranges[f], ranges, extents, merge, gap, io_size, buf_len );
+   }
+
+   SG_debug("%zu ranges in %zu files, %zu extents\n", ranges.size(), files.size(), extents.size() );
+}
+
+
+/**
+ * @brief Print all ranges in argument order, reading each file through one handle
+ *
+ * Nearby ranges are merged into extents, which are read with one UG_read each
+ * when first needed and freed once all of their ranges are printed.
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int read_vectored( struct UG_state* ug, std::vector<struct read_range>& ranges, uint64_t gap, uint64_t io_size, char* buf, size_t buf_len, struct read_sink* sink ) {
+
+   int rc = 0;
+   int close_rc = 0;
+   std::vector<struct read_file> files;
+   std::vector<struct read_extent> extents;
+   uint64_t lo = 0;
+   uint64_t hi = 0;
+
+   read_plan( ranges, true, gap, io_size, buf_len, files, extents );
+
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      struct read_range* r = &ranges[i];
+      struct read_extent* ext = &extents[ r->extent ];
+      struct read_file* rf = &files[ ext->file ];
+
+      SG_debug("Read: '%s' %" PRIu64 " %" PRIu64 "\n", r->path, r->offset, r->len );
+
+      // try to open...
+      if( rf->fh == NULL ) {
+
+         rf->fh = UG_open( ug, rf->path, O_RDONLY, &rc );
+         if( rc != 0 ) {
+
+            rf->fh = NULL;
+            fprintf(stderr, "Failed to open %s: %s\n", rf->path, strerror(-rc));
+            break;
+         }
+      }
+
+      if( ext->len > buf_len ) {
+
+         // too big to hold; read it straight through 
+         rc = read_stream( ug, rf->fh, rf->path, r->offset, r->len, buf, buf_len, io_size, sink );
+         if( rc != 0 ) {
+            break;
+         }
+      }
+      else {
+
+         if( !ext->fetched ) {
+
+            ext->data = SG_CALLOC( char, ext->len );
+            if( ext->data == NULL ) {
+               rc = -ENOMEM;
+               break;
+            }
+
+            rc = read_fetch( ug, rf->fh, ext->data, ext->offset, ext->len, &ext->data_len );
+            if( rc != 0 ) {
+
+               fprintf(stderr, "%s: read: %s\n", rf->path, strerror(-rc));
+               break;
+            }
+
+            ext->fetched = true;
+         }
+
+         lo = std::max( r->offset, ext->offset );
+         hi = std::min( r->offset + r->len, ext->offset + ext->data_len );
+
+         if( lo < hi ) {
+
+            rc = read_emit( sink, ext->data + (lo - ext->offset), lo, hi - lo );
+            if( rc != 0 ) {
+               break;
+            }
+         }
+
+         fflush( stdout );
+      }
+
+      ext->refs--;
+      if( ext->refs == 0 ) {
+         SG_safe_free( ext->data );
+      }
+   }
+
+   // close up 
+   for( size_t f = 0; f < files.size(); f++ ) {
+
+      if( files[f].fh == NULL ) {
+         continue;
+      }
+
+      close_rc = UG_close( ug, files[f].fh );
+      if( close_rc < 0 ) {
+
+         fprintf(stderr, "%s: close: %s\n", files[f].path, strerror(-close_rc));
+         if( rc == 0 ) {
+            rc = close_rc;
+         }
+      }
+   }
+
+   for( size_t e = 0; e < extents.size(); e++ ) {
+      SG_safe_free( extents[e].data );
+   }
+
+   return rc;
+}
+
+
+/**
+ * @brief Split ranges longer than buf_len at multiples of buf_len, so every range's extent fits into one buffer
+ *
+ * The pieces of a range stay next to each other, so they are still printed in order.
+ */
+static void read_split_ranges( std::vector<struct read_range>& ranges, size_t buf_len ) {
+
+   std::vector<struct read_range> split;
+   struct read_range piece;
+   uint64_t end = 0;
+
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      piece = ranges[i];
+      end = ranges[i].offset + ranges[i].len;
+
+      while( true ) {
+
+         piece.len = std::min( end, (piece.offset / buf_len + 1) * buf_len ) - piece.offset;
+         split.push_back( piece );
+
+         if( piece.offset + piece.len >= end ) {
+            break;
+         }
+
+         piece.offset += piece.len;
+      }
+   }
+
+   ranges.swap( split );
+}
+
+
+/**
+ * @brief Write all ranges in a fetched extent to the output file
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int read_write_extent( struct read_parallel_ctx* ctx, size_t e ) {
+
+   int rc = 0;
+   struct read_extent* ext = &(*ctx->extents)[e];
+   std::vector<size_t>& idx = ctx->extent_ranges[e];
+   uint64_t lo = 0;
+   uint64_t hi = 0;
+
+   for( size_t i = 0; i < idx.size(); i++ ) {
+
+      struct read_range* r = &(*ctx->ranges)[ idx[i] ];
+
+      lo = std::max( r->offset, ext->offset );
+      hi = std::min( r->offset + r->len, ext->offset + ext->data_len );
+
+      if( lo < hi ) {
+
+         rc = read_emit( ctx->sink, ext->data + (lo - ext->offset), lo, hi - lo );
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Fetch worker: fetch extents in the order they are needed, each file through a handle of its own
+ */
+static void* read_parallel_worker( void* cls ) {
+
+   struct read_parallel_ctx* ctx = (struct read_parallel_ctx*)cls;
+   std::map<size_t, UG_handle_t*> handles;
+   std::map<size_t, UG_handle_t*>::iterator itr;
+   struct read_extent* ext = NULL;
+   struct read_file* rf = NULL;
+   UG_handle_t* fh = NULL;
+   size_t e = 0;
+   int rc = 0;
+
+   pthread_mutex_lock( &ctx->lock );
+
+   while( true ) {
+
+      // wait for room to hold the next extent
+      while( !ctx->stop && ctx->rc == 0 && ctx->next < ctx->order.size() ) {
+
+         e = ctx->order[ ctx->next ];
+
+         if( ctx->used == 0 || ctx->used + (*ctx->extents)[e].len <= ctx->limit || (ssize_t)e == ctx->waiting_for ) {
+            break;
+         }
+
+         pthread_cond_wait( &ctx->cond, &ctx->lock );
+      }
+
+      if( ctx->stop || ctx->rc != 0 || ctx->next >= ctx->order.size() ) {
+         break;
+      }
+
+      ctx->next++;
+      ext = &(*ctx->extents)[e];
+      rf = &(*ctx->files)[ ext->file ];
+      ctx->used += ext->len;
+
+      pthread_mutex_unlock( &ctx->lock );
+
+      // try to open...
+      fh = NULL;
+      rc = 0;
+
+      itr = handles.find( ext->file );
+      if( itr != handles.end() ) {
+         fh = itr->second;
+      }
+      else {
+
+         fh = UG_open( ctx->ug, rf->path, O_RDONLY, &rc );
+         if( rc != 0 ) {
+
+            fprintf(stderr, "Failed to open %s: %s\n", rf->path, strerror(-rc));
+            fh = NULL;
+         }
+         else {
+            handles[ ext->file ] = fh;
+         }
+      }
+
+      if( rc == 0 ) {
+
+         ext->data = SG_CALLOC( char, ext->len );
+         if( ext->data == NULL ) {
+            rc = -ENOMEM;
+         }
+         else {
+
+            rc = read_fetch( ctx->ug, fh, ext->data, ext->offset, ext->len, &ext->data_len );
+            if( rc != 0 ) {
+               fprintf(stderr, "%s: read: %s\n", rf->path, strerror(-rc));
+            }
+         }
+      }
+
+      if( rc == 0 && ctx->sink->fd >= 0 ) {
+
+         // nothing to reorder; write the extent's ranges out now
+         rc = read_write_extent( ctx, e );
+         SG_safe_free( ext->data );
+      }
+
+      pthread_mutex_lock( &ctx->lock );
+
+      if( ext->data == NULL ) {
+         ctx->used -= ext->len;
+      }
+
+      if( rc != 0 ) {
+         if( ctx->rc == 0 ) {
+            ctx->rc = rc;
+         }
+      }
+      else {
+         ext->fetched = true;
+      }
+
+      pthread_cond_broadcast( &ctx->cond );
+   }
+
+   pthread_mutex_unlock( &ctx->lock );
+
+   // close up 
+   for( itr = handles.begin(); itr != handles.end(); itr++ ) {
+
+      rc = UG_close( ctx->ug, itr->second );
+      if( rc < 0 ) {
+         fprintf(stderr, "%s: close: %s\n", (*ctx->files)[ itr->first ].path, strerror(-rc));
+      }
+   }
+
+   return NULL;
+}
+
+
+/**
+ * @brief Print all ranges in argument order, fetching them with num_workers threads
+ *
+ * With --output, each range is written out by the worker that fetched it, in no particular order.
+ *
+ * @param[in] merge If true, merge nearby ranges as with --vectored
+ * @param[in] limit Most bytes of fetched data to hold while waiting to print it
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int read_parallel( struct UG_state* ug, std::vector<struct read_range>& ranges, bool merge, uint64_t gap, uint64_t io_size, size_t buf_len, int num_workers, uint64_t limit, struct read_sink* sink ) {
+
+   int rc = 0;
+   int num_started = 0;
+   struct read_parallel_ctx ctx;
+   std::vector<struct read_file> files;
+   std::vector<struct read_extent> extents;
+   std::vector<bool> ordered;
+   pthread_t* threads = NULL;
+   uint64_t lo = 0;
+   uint64_t hi = 0;
+
+   // each range fits into one buffer, so memory use is bounded
+   read_split_ranges( ranges, buf_len );
+   read_plan( ranges, merge, gap, io_size, buf_len, files, extents );
+
+   ctx.ug = ug;
+   ctx.ranges = &ranges;
+   ctx.extents = &extents;
+   ctx.files = &files;
+   ctx.sink = sink;
+   ctx.next = 0;
+   ctx.used = 0;
+   ctx.limit = limit;
+   ctx.waiting_for = -1;
+   ctx.stop = false;
+   ctx.rc = 0;
+
+   ordered.resize( extents.size(), false );
+   ctx.extent_ranges.resize( extents.size() );
+
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      ctx.extent_ranges[ ranges[i].extent ].push_back( i );
+
+      if( !ordered[ ranges[i].extent ] ) {
+         ordered[ ranges[i].extent ] = true;
+         ctx.order.push_back( ranges[i].extent );
+      }
+   }
+
+   threads = SG_CALLOC( pthread_t, num_workers );
+   if( threads == NULL ) {
+      return -ENOMEM;
+   }
+
+   pthread_mutex_init( &ctx.lock, NULL );
+   pthread_cond_init( &ctx.cond, NULL );
+
+   num_started = start_threads( threads, num_workers, read_parallel_worker, &ctx );
+   if( num_started < 0 ) {
+
+      fprintf(stderr, "Failed to start fetch threads: %s\n", strerror(-num_started));
+      rc = num_started;
+      num_started = 0;
+   }
+
+   // print ranges in order as their extents arrive (unless the workers write them out)
+   for( size_t i = 0; rc == 0 && sink->fd < 0 && i < ranges.size(); i++ ) {
+
+      struct read_range* r = &ranges[i];
+      struct read_extent* ext = &extents[ r->extent ];
+
+      // wait for the range's extent
+      pthread_mutex_lock( &ctx.lock );
+
+      while( !ext->fetched && ctx.rc == 0 ) {
+
+         ctx.waiting_for = r->extent;
+         pthread_cond_broadcast( &ctx.cond );
+         pthread_cond_wait( &ctx.cond, &ctx.lock );
+      }
+
+      ctx.waiting_for = -1;
+      rc = ctx.rc;
+
+      pthread_mutex_unlock( &ctx.lock );
+
+      if( rc != 0 ) {
+         break;
+      }
+
+      lo = std::max( r->offset, ext->offset );
+      hi = std::min( r->offset + r->len, ext->offset + ext->data_len );
+
+      if( lo < hi ) {
+         rc = read_emit( sink, ext->data + (lo - ext->offset), lo, hi - lo );
+      }
+
+      // free the extent once it is fully printed
+      pthread_mutex_lock( &ctx.lock );
+
+      ext->refs--;
+      if( ext->refs == 0 ) {
+
+         SG_safe_free( ext->data );
+         ctx.used -= ext->len;
+         pthread_cond_broadcast( &ctx.cond );
+      }
+
+      pthread_mutex_unlock( &ctx.lock );
+   }
+
+   fflush( stdout );
+
+   // stop fetching if printing stopped early
+   if( sink->fd < 0 ) {
+
+      pthread_mutex_lock( &ctx.lock );
+      ctx.stop = true;
+      pthread_cond_broadcast( &ctx.cond );
+      pthread_mutex_unlock( &ctx.lock );
+   }
+
+   join_threads( threads, num_started );
+
+   if( rc == 0 ) {
+      rc = ctx.rc;
+   }
+
+   for( size_t e = 0; e < extents.size(); e++ ) {
+      SG_safe_free( extents[e].data );
+   }
+
+   pthread_cond_destroy( &ctx.cond );
+   pthread_mutex_destroy( &ctx.lock );
+   SG_safe_free( threads );
+
+   return rc;
+}
+
+
+/**
+ * @brief Print all ranges in argument order, prefetching ahead of each file's sequential or strided ranges
+ *
+ * Bytes that were prefetched are printed from the readahead windows; the rest are read
+ * through a handle opened for the range, as in the default mode.
+ *
+ * @param[in] max_window Most bytes to prefetch ahead of a file's ranges
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int read_readahead( struct UG_state* ug, std::vector<struct read_range>& ranges, uint64_t io_size, uint64_t max_window, char* buf, size_t buf_len, struct read_sink* sink ) {
+
+   int rc = 0;
+   int close_rc = 0;
+   std::map<std::string, struct readahead*> ras;
+   std::map<std::string, struct readahead*>::iterator itr;
+   struct readahead* ra = NULL;
+   UG_handle_t* fh = NULL;
+   char const* data = NULL;
+   ssize_t nr = 0;
+   bool eof = false;
+   uint64_t pos = 0;
+   uint64_t end = 0;
+
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      struct read_range* r = &ranges[i];
+
+      SG_debug("Read: '%s' %" PRIu64 " %" PRIu64 "\n", r->path, r->offset, r->len );
+
+      itr = ras.find( std::string(r->path) );
+      if( itr != ras.end() ) {
+         ra = itr->second;
+      }
+      else {
+
+         ra = readahead_new( ug, r->path, io_size, max_window );
+         if( ra == NULL ) {
+            rc = -ENOMEM;
+            break;
+         }
+
+         ras[ std::string(r->path) ] = ra;
+      }
+
+      // print what was prefetched
+      pos = r->offset;
+      end = r->offset + r->len;
+      eof = false;
+
+      while( pos < end ) {
+
+         nr = readahead_get( ra, pos, end - pos, &data, &eof );
+         if( nr <= 0 ) {
+            break;
+         }
+
+         rc = read_emit( sink, data, pos, nr );
+         if( rc != 0 ) {
+            break;
+         }
+
+         pos += nr;
+      }
+
+      if( rc != 0 ) {
+         break;
+      }
+
+      if( pos < end && !eof ) {
+
+         // not prefetched; read the rest ourselves
+         fh = UG_open( ug, r->path, O_RDONLY, &rc );
+         if( rc != 0 ) {
+
+            fprintf(stderr, "Failed to open %s: %s\n", r->path, strerror(-rc));
+            break;
+         }
+
+         rc = read_stream( ug, fh, r->path, pos, end - pos, buf, buf_len, io_size, sink );
+
+         close_rc = UG_close( ug, fh );
+         if( close_rc < 0 ) {
+
+            fprintf(stderr, "%s: close: %s\n", r->path, strerror(-close_rc));
+            if( rc == 0 ) {
+               rc = close_rc;
+            }
+         }
+
+         if( rc != 0 ) {
+            break;
+         }
+      }
+
+      fflush( stdout );
+
+      readahead_access( ra, r->offset, r->len );
+   }
+
+   for( itr = ras.begin(); itr != ras.end(); itr++ ) {
+      readahead_free( itr->second );
+   }
+
+   return rc;
+}
+
+
 /**
  * @brief syndicate-read entry point
  *
@@ -37,17 +896,17 @@ int main( int argc, char** argv ) {
    int rc = 0;
    struct UG_state* ug = NULL;
    struct SG_gateway* gateway = NULL;
-   char* path = NULL;
    int path_optind = 0;
-   char buf[BUF_LEN]; 
-   ssize_t nr = 0;
+   char* buf = NULL;
+   size_t buf_len = 0;
+   uint64_t io_size = 0;
+   uint64_t limit = 0;
    int close_rc = 0;
    UG_handle_t* fh = NULL;
-   uint64_t offset = 0;
-   uint64_t len = 0;
+   struct read_sink sink;
+   struct read_range range;
+   std::vector<struct read_range> ranges;
    char* tmp = NULL;
-   uint64_t num_read = 0;
-   char debug_buf[52];
 
    mode_t um = umask(0);
    umask( um );
@@ -56,10 +915,10 @@ int main( int argc, char** argv ) {
    
    memset( &opts, 0, sizeof(tool_opts) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, TOOL_OPT_JOBS | TOOL_OPT_BUFFER | TOOL_OPT_IO_SIZE | TOOL_OPT_VECTORED | TOOL_OPT_READAHEAD | TOOL_OPT_OUTPUT );
    if( argc < 0 ) {
       
-      usage( argv[0], "syndicate_file offset len [syndicate_file offset len..]" );
+      usage( argv[0], "[-j|--jobs|--parallel N] [--buffer SIZE] [--io-size SIZE] [--vectored [--gap SIZE]] [--readahead SIZE] [--output FILE] syndicate_file offset len [syndicate_file offset len...]" );
       md_common_usage();
       exit(1);
    }
@@ -78,7 +937,7 @@ int main( int argc, char** argv ) {
    path_optind = SG_gateway_first_arg_optind( gateway );
    if( path_optind == argc ) {
       
-      usage( argv[0], "syndicate_file syndicate_file offset len [syndicate_file offset len...]" );
+      usage( argv[0], "[-j|--jobs|--parallel N] [--buffer SIZE] [--io-size SIZE] [--vectored [--gap SIZE]] [--readahead SIZE] [--output FILE] syndicate_file offset len [syndicate_file offset len...]" );
       UG_shutdown( ug );
       exit(1);
    }
@@ -86,81 +945,103 @@ int main( int argc, char** argv ) {
    // sanity check 
    if( (argc - path_optind) % 3 != 0 ) {
 
-      usage( argv[0], "syndicate_file syndicate_file offset len [syndicate_file offset len...]");
+      usage( argv[0], "[-j|--jobs|--parallel N] [--buffer SIZE] [--io-size SIZE] [--vectored [--gap SIZE]] [--readahead SIZE] [--output FILE] syndicate_file offset len [syndicate_file offset len...]");
       UG_shutdown( ug );
       exit(1);
    }
 
    for( int i = path_optind; i < argc; i+=3 ) {
 
-      path = argv[i];
-      offset = (uint64_t)strtoull( argv[i+1], &tmp, 10 );
-      if( offset == 0 && *tmp != '\0' ) {
+      memset( &range, 0, sizeof(struct read_range) );
+
+      range.path = argv[i];
+      range.offset = (uint64_t)strtoull( argv[i+1], &tmp, 10 );
+      if( range.offset == 0 && *tmp != '\0' ) {
          fprintf(stderr, "Failed to parse offset (argument %d)\n", i+1 );
          UG_shutdown(ug);
          exit(1);
       }
 
-      len = (uint64_t)strtoull( argv[i+2], &tmp, 10 );
-      if( len == 0 && *tmp != '\0' ) {
+      range.len = (uint64_t)strtoull( argv[i+2], &tmp, 10 );
+      if( range.len == 0 && *tmp != '\0' ) {
          fprintf(stderr, "Failed to parse len (argument %d)\n", i+2 );
          UG_shutdown(ug);
          exit(1);
       }
 
-      SG_debug("Read: '%s' %" PRIu64 " %" PRIu64 "\n", path, offset, len );
+      ranges.push_back( range );
+   }
+
+   // reads cover whole I/O units, so the buffer holds a whole number of them
+   io_size = get_io_size( ug, &opts );
+   buf_len = io_align( BUF_LEN, io_size );
+
+   buf = SG_CALLOC( char, buf_len );
+   if( buf == NULL ) {
+
+      SG_error("%s", "Out of memory\n");
+      UG_shutdown( ug );
+      exit(1);
+   }
+
+   // write ranges into a local file at their own offsets, or print them
+   sink.path = opts.output;
+   sink.fd = -1;
+
+   if( opts.output != NULL ) {
+
+      sink.fd = open( opts.output, O_WRONLY | O_CREAT, 0666 );
+      if( sink.fd < 0 ) {
+
+         rc = -errno;
+         fprintf(stderr, "Failed to open '%s': %s\n", opts.output, strerror(-rc));
+         goto read_end;
+      }
+   }
+
+   if( opts.jobs > 1 ) {
+
+      // hold up to --buffer bytes of fetched ranges that are waiting to be printed
+      limit = opts.buffer_size;
+      if( limit == 0 ) {
+         limit = (uint64_t)2 * opts.jobs * buf_len;
+      }
+
+      rc = read_parallel( ug, ranges, opts.vectored, opts.gap, io_size, buf_len, opts.jobs, limit, &sink );
+      goto read_end;
+   }
+
+   if( opts.vectored ) {
+
+      rc = read_vectored( ug, ranges, opts.gap, io_size, buf, buf_len, &sink );
+      goto read_end;
+   }
+
+   if( opts.readahead > 0 ) {
+
+      rc = read_readahead( ug, ranges, io_size, opts.readahead, buf, buf_len, &sink );
+      goto read_end;
+   }
+
+   for( size_t i = 0; i < ranges.size(); i++ ) {
+
+      SG_debug("Read: '%s' %" PRIu64 " %" PRIu64 "\n", ranges[i].path, ranges[i].offset, ranges[i].len );
 
       // try to open...
-      fh = UG_open( ug, path, O_RDONLY, &rc );
+      fh = UG_open( ug, ranges[i].path, O_RDONLY, &rc );
       if( rc != 0 ) {
 
-         fprintf(stderr, "Failed to open %s: %s\n", path, strerror(-rc));
+         fprintf(stderr, "Failed to open %s: %s\n", ranges[i].path, strerror(-rc));
          goto read_end;
       }
 
-      // try to seek... 
-      UG_seek( fh, offset, SEEK_SET );
-
-      // try to read 
-      nr = 0;
-      num_read = 0;
-      while( num_read < len ) {
-          nr = UG_read( ug, buf, std::min(len - num_read, (uint64_t)BUF_LEN), fh );
-          if( nr < 0 ) {
-    
-             fprintf(stderr, "%s: read: %s\n", path, strerror(-nr));
-             rc = nr;
-             break;
-          }
-          if( nr == 0 ) {
-
-             // EOF
-             SG_debug("EOF on %s\n", path ); 
-             rc = 0;
-             break;
-          }
-
-          memset(debug_buf, 0, 52);
-          for( int i = 0; i < (50 / 3) && i < nr; i++ ) {
-             char nbuf[5];
-             memset(nbuf, 0, 5);
-             snprintf(nbuf, 4, " %02X", buf[i]);
-             strcat(debug_buf, nbuf);
-          }
-          
-          SG_debug("Read %zd bytes (%s...)\n", nr, debug_buf );
-
-          fwrite( buf, 1, nr, stdout );
-          fflush( stdout );
-
-          num_read += nr;
-      }
+      rc = read_stream( ug, fh, ranges[i].path, ranges[i].offset, ranges[i].len, buf, buf_len, io_size, &sink );
       
       // close up 
       close_rc = UG_close( ug, fh );
       if( close_rc < 0 ) {
 
-         fprintf(stderr, "%s: close: %s\n", path, strerror(-close_rc));
+         fprintf(stderr, "%s: close: %s\n", ranges[i].path, strerror(-close_rc));
          break;
       }
 
@@ -171,6 +1052,16 @@ int main( int argc, char** argv ) {
 
 read_end:
    UG_shutdown( ug );
+   SG_safe_free( buf );
+
+   if( sink.fd >= 0 ) {
+
+      if( close( sink.fd ) != 0 && rc == 0 ) {
+
+         rc = -errno;
+         fprintf(stderr, "Failed to close '%s': %s\n", opts.output, strerror(-rc));
+      }
+   }
 
    if( rc != 0 ) {
       exit(1);
@@ -34,11 +34,33 @@
  * @brief Read file range to standard output
  *
  * @section synopsis SYNOPSIS
- * syndicate-read -u USERNAME -v VOLUME_NAME -g GATEWAY_NAME [OPTION]... /FILE OFFSET LENGTH
+ * syndicate-read -u USERNAME -v VOLUME_NAME -g GATEWAY_NAME [OPTION]... /FILE OFFSET LENGTH [/FILE OFFSET LENGTH]...
  *
  * @section description DESCRIPTION
  * Read a FILE in syndicate starting at the OFFSET and ending at the LENGTH (in bytes) and print on the standard output.
  *
+ * @section options OPTIONS
+ * -j, --jobs, --parallel N\n
+ * Fetch up to N ranges at once, each worker through handles of its own.  Ranges are still printed in the order given.  Ranges longer than the read buffer are fetched in buffer-sized pieces.
+ *
+ * --buffer SIZE\n
+ * With -j, hold at most SIZE bytes of fetched data that is waiting to be printed (K, M and G suffixes are allowed).  The default is two read buffers per worker.
+ *
+ * --output LOCALFILE\n
+ * Instead of printing the ranges, write each one into LOCALFILE at the same offset it has in FILE.  LOCALFILE is created if it does not exist, and is not truncated, so the bytes outside the ranges are left alone (or are holes in a new file).  With -j, each range is written as soon as it is fetched, in no particular order.
+ *
+ * --vectored\n
+ * Read all ranges of the same FILE through one open handle.  The ranges are sorted, and ranges that overlap or are close together are read with a single read.  They are still printed in the order given.
+ *
+ * --gap SIZE\n
+ * With --vectored, also merge ranges that are up to SIZE bytes apart (K, M and G suffixes are allowed).  The default is 0, so only ranges that share an I/O unit are merged.
+ *
+ * --readahead SIZE\n
+ * When a FILE's ranges are read one after another (each starting where the last one ended), or at a fixed stride, fetch the next ranges in the background while the current one is printed, up to SIZE bytes ahead (K, M and G suffixes are allowed).  The amount fetched ahead starts small, grows while the prefetched data is used, and shrinks when it is not.  Ignored with -j and --vectored, which plan all reads up front.
+ *
+ * --io-size SIZE\n
+ * Read from Syndicate in whole multiples of SIZE bytes, starting at the multiple of SIZE at or before OFFSET (K, M and G suffixes are allowed).  Only the requested bytes are printed.  The default is the volume's block size.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -68,6 +90,14 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "common.h"
+#include "readahead.h"
 
 #endif
@@ -26,6 +26,24 @@
 
 #include "syndicate-touch.h"
 
+/**
+ * @brief Set a file's access and modification times to now
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int touch_utime( struct UG_state* ug, char const* path ) {
+
+   struct timespec ts;
+   struct utimbuf utime;
+
+   clock_gettime( CLOCK_REALTIME, &ts );
+   utime.actime = ts.tv_sec;
+   utime.modtime = ts.tv_sec;
+
+   return UG_utime( ug, path, &utime );
+}
+
 /**
  * @brief syndicate-cat entry point
  *
@@ -40,12 +58,13 @@ int main( int argc, char** argv ) {
    int64_t* times = NULL;
    struct timespec ts_begin;
    struct timespec ts_end;
+   struct nameset* names = NULL;
 
    struct tool_opts opts;
    
    memset( &opts, 0, sizeof(tool_opts) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, 0 );
    if( argc < 0 ) {
       
       usage( argv[0], "file [file...]" );
@@ -81,9 +100,27 @@ int main( int argc, char** argv ) {
       }
    }
    
+   // find out which files already exist, a directory at a time
+   nameset_build( ug, (char const* const*)&argv[path_optind], argc - path_optind, &names );
+
    for( int i = path_optind; i < argc; i++ ) {
         
        path = argv[ i ];
+
+       if( names != NULL && nameset_lookup( names, path ) == NAMESET_EXISTS ) {
+
+          // known to exist; just update its timestamps
+          rc = touch_utime( ug, path );
+          if( rc != -ENOENT ) {
+
+             if( rc != 0 ) {
+                fprintf(stderr, "Failed to update timestamps on '%s': %s\n", path, strerror( abs(rc) ) );
+             }
+             continue;
+          }
+
+          // removed since; create it after all
+       }
        
        // try to create 
        clock_gettime( CLOCK_MONOTONIC, &ts_begin );
@@ -100,14 +137,7 @@ int main( int argc, char** argv ) {
             
              // already exists.
              // update timestamp
-             struct timespec ts;
-             struct utimbuf utime;
-
-             clock_gettime( CLOCK_REALTIME, &ts );
-             utime.actime = ts.tv_sec;
-             utime.modtime = ts.tv_sec;
-
-             rc = UG_utime( ug, path, &utime );
+             rc = touch_utime( ug, path );
              if( rc != 0 ) {
                 fprintf(stderr, "Failed to update timestamps on '%s': %s\n", path, strerror( abs(rc) ) );
                 continue;
@@ -133,6 +163,7 @@ int main( int argc, char** argv ) {
    }
    
    UG_shutdown( ug );
+   nameset_free( names );
 
    if( times != NULL ) {
     
@@ -41,6 +41,8 @@
  *
  * A FILE argument that does not exist is created empty
  *
+ * The directories that hold two or more of the FILEs are listed once up front, so that each FILE that already exists only needs its timestamps updated, instead of a failed create first.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -70,5 +72,6 @@
 #include <libsyndicate-ug/core.h>
 
 #include "common.h"
+#include "nameset.h"
 
 #endif
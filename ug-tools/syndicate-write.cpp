@@ -26,7 +26,233 @@
 
 #include "syndicate-write.h"
 
-#define BUF_SIZE 4096
+#define BUF_SIZE 1024 * 1024 * 10
+#define PIPELINE_DEPTH 2
+
+/**
+ * @brief A local file to write at an offset in the Syndicate file
+ */
+struct write_segment {
+   char* local_path;               ///< Path to the local file
+   int fd;                         ///< Open descriptor of the local file
+   off_t offset;                   ///< Offset in the Syndicate file
+   off_t len;                      ///< Number of bytes to write
+   char* data;                     ///< The file's contents, if it is not a regular file (e.g. a pipe)
+};
+
+/**
+ * @brief A range of the Syndicate file whose data comes from one segment
+ */
+struct write_piece {
+   size_t seg;                     ///< Index of the segment
+   off_t offset;                   ///< Offset in the Syndicate file
+   off_t len;                      ///< Length of the range
+};
+
+/**
+ * @brief Fill stage closure for a run of adjacent pieces
+ */
+struct write_run {
+   struct write_segment* segs;     ///< All segments
+   struct write_piece* pieces;     ///< The first piece in the run
+   size_t num_pieces;              ///< Number of pieces in the run
+   size_t next;                    ///< Index of the piece being read
+   off_t piece_pos;                ///< Bytes of that piece already read
+   size_t head_len;                ///< If nonzero, the first fill stops after this many bytes
+   struct write_segment* failed;   ///< The segment that could not be read, if any
+};
+
+
+/**
+ * @brief Open a segment's local file and find out how long it is
+ *
+ * Files that are not regular files are read into memory, since they can't be read at an offset.
+ *
+ * @retval 0 Success
+ * @retval -errno Failure
+ */
+static int write_segment_load( struct write_segment* seg ) {
+
+   struct stat sb;
+   size_t cap = 0;
+   ssize_t nr = 0;
+   char* tmp = NULL;
+
+   seg->fd = open( seg->local_path, O_RDONLY );
+   if( seg->fd < 0 ) {
+      return -errno;
+   }
+
+   if( fstat( seg->fd, &sb ) != 0 ) {
+      return -errno;
+   }
+
+   if( S_ISREG( sb.st_mode ) ) {
+      seg->len = sb.st_size;
+      return 0;
+   }
+
+   seg->len = 0;
+
+   while( true ) {
+
+      if( (size_t)seg->len == cap ) {
+
+         cap = (cap == 0 ? BUF_SIZE : cap * 2);
+         tmp = (char*)realloc( seg->data, cap );
+         if( tmp == NULL ) {
+            return -ENOMEM;
+         }
+
+         seg->data = tmp;
+      }
+
+      nr = read( seg->fd, seg->data + seg->len, cap - seg->len );
+      if( nr < 0 ) {
+
+         if( errno == EINTR ) {
+            continue;
+         }
+
+         return -errno;
+      }
+      if( nr == 0 ) {
+         break;
+      }
+
+      seg->len += nr;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Work out which segment supplies each byte of the Syndicate file
+ *
+ * Where segments overlap, the one given last on the command line wins.
+ * The pieces come out sorted by offset, and adjacent pieces from the same segment are merged.
+ */
+static void write_pieces( std::vector<struct write_segment>& segs, std::vector<struct write_piece>& pieces ) {
+
+   // (offset, segment index + 1) where a segment starts, (offset, -(segment index + 1)) where it ends
+   std::vector< std::pair<off_t, ssize_t> > events;
+   std::set<size_t> active;
+   struct write_piece piece;
+   off_t prev = 0;
+   off_t pos = 0;
+   size_t i = 0;
+
+   for( i = 0; i < segs.size(); i++ ) {
+
+      if( segs[i].len > 0 ) {
+         events.push_back( std::make_pair( segs[i].offset, (ssize_t)(i + 1) ) );
+         events.push_back( std::make_pair( segs[i].offset + segs[i].len, -(ssize_t)(i + 1) ) );
+      }
+   }
+
+   std::sort( events.begin(), events.end() );
+
+   i = 0;
+   while( i < events.size() ) {
+
+      pos = events[i].first;
+
+      // everything since the last event comes from the latest segment that covers it
+      if( !active.empty() && pos > prev ) {
+
+         piece.seg = *active.rbegin();
+         piece.offset = prev;
+         piece.len = pos - prev;
+
+         if( !pieces.empty() && pieces.back().seg == piece.seg && pieces.back().offset + pieces.back().len == piece.offset ) {
+            pieces.back().len += piece.len;
+         }
+         else {
+            pieces.push_back( piece );
+         }
+      }
+
+      for( ; i < events.size() && events[i].first == pos; i++ ) {
+
+         if( events[i].second > 0 ) {
+            active.insert( events[i].second - 1 );
+         }
+         else {
+            active.erase( -events[i].second - 1 );
+         }
+      }
+
+      prev = pos;
+   }
+}
+
+
+/**
+ * @brief Fill stage for a run: copy each piece's bytes in order
+ *
+ * @param[in] cls A struct write_run
+ */
+static ssize_t write_fill_run( void* cls, char* buf, size_t len ) {
+
+   struct write_run* run = (struct write_run*)cls;
+   struct write_piece* piece = NULL;
+   struct write_segment* seg = NULL;
+   size_t total = 0;
+   size_t n = 0;
+   ssize_t nr = 0;
+   off_t src = 0;
+
+   if( run->head_len > 0 ) {
+      len = std::min( len, run->head_len );
+      run->head_len = 0;
+   }
+
+   while( total < len && run->next < run->num_pieces ) {
+
+      piece = &run->pieces[ run->next ];
+      seg = &run->segs[ piece->seg ];
+
+      src = piece->offset - seg->offset + run->piece_pos;
+      n = std::min( (off_t)(len - total), piece->len - run->piece_pos );
+
+      if( seg->data != NULL ) {
+         memcpy( buf + total, seg->data + src, n );
+      }
+      else {
+
+         nr = pread( seg->fd, buf + total, n, src );
+         if( nr < 0 ) {
+
+            if( errno == EINTR ) {
+               continue;
+            }
+
+            run->failed = seg;
+            return -errno;
+         }
+         if( nr == 0 ) {
+
+            // file got shorter
+            run->failed = seg;
+            return -EIO;
+         }
+
+         n = nr;
+      }
+
+      total += n;
+      run->piece_pos += n;
+
+      if( run->piece_pos == piece->len ) {
+         run->next++;
+         run->piece_pos = 0;
+      }
+   }
+
+   return total;
+}
+
 
 /**
  * @brief syndicate-write entry point
@@ -39,11 +265,17 @@ int main( int argc, char** argv ) {
    struct SG_gateway* gateway = NULL;
    char* syndicate_path = NULL;
    int args_start = 0;
-   char* local_path = NULL;
-   int fd = 0;
-   char buf[BUF_SIZE];
-   ssize_t nr = 0;
-   int64_t offset = 0;
+   struct pipeline* pl = NULL;
+   struct pipeline_ug ugf;
+   struct pipeline_stats stats;
+   struct write_segment seg;
+   struct write_run run;
+   std::vector<struct write_segment> segs;
+   std::vector<struct write_piece> pieces;
+   size_t end = 0;
+   off_t run_len = 0;
+   uint64_t io_size = 0;
+   size_t buf_len = 0;
    UG_handle_t* fh = NULL;
    char* tmp = NULL;
 
@@ -54,10 +286,10 @@ int main( int argc, char** argv ) {
    
    memset( &opts, 0, sizeof(tool_opts) );
    
-   argc = parse_args( argc, argv, &opts );
+   argc = parse_args( argc, argv, &opts, TOOL_OPT_MMAP | TOOL_OPT_IO_SIZE );
    if( argc < 0 ) {
       
-      usage( argv[0], "syndicate_file local_file offset [local_file offset...]" );
+      usage( argv[0], "[--mmap] [--io-size SIZE] syndicate_file local_file offset [local_file offset...]" );
       md_common_usage();
       exit(1);
    }
@@ -76,71 +308,107 @@ int main( int argc, char** argv ) {
    args_start = SG_gateway_first_arg_optind( gateway );
    if( args_start == argc || (argc - args_start - 1) % 2 != 0 ) {
       
-      usage( argv[0], "syndicate_file local_file offset [local_file offset...]" );
+      usage( argv[0], "[--mmap] [--io-size SIZE] syndicate_file local_file offset [local_file offset...]" );
       UG_shutdown( ug );
       exit(1);
    }
    
    syndicate_path = argv[args_start];
 
+   io_size = get_io_size( ug, &opts );
+   buf_len = io_align( BUF_SIZE, io_size );
+
+   // get all the segments first, so they can be written in offset order
+   segs.reserve( (argc - args_start - 1) / 2 );
+
    for( int i = args_start + 1; i < argc; i += 2 ) {
       
-      local_path = argv[i];
-      offset = (int64_t)strtoll( argv[i+1], &tmp, 10 );
-      if( offset == 0 && tmp == argv[i+1] ) {
+      memset( &seg, 0, sizeof(struct write_segment) );
 
-         usage(argv[0], "local_file syndicate_file offset [local_file syndicate_file offset...]");
-         UG_shutdown(ug);
-         exit(1);
-      }
+      seg.local_path = argv[i];
+      seg.offset = (off_t)strtoll( argv[i+1], &tmp, 10 );
+      if( (seg.offset == 0 && tmp == argv[i+1]) || seg.offset < 0 ) {
 
-      // get the file...
-      fd = open( local_path, O_RDONLY );
-      if( fd < 0 ) {
-         rc = -errno;
-         fprintf(stderr, "Failed to open '%s': %s\n", local_path, strerror(-rc));
+         usage( argv[0], "[--mmap] [--io-size SIZE] syndicate_file local_file offset [local_file offset...]" );
          rc = 1;
          goto write_end;
       }
-       
-      // open syndicate file
-      fh = UG_open( ug, syndicate_path, O_WRONLY, &rc );
+
+      segs.push_back( seg );
+
+      rc = write_segment_load( &segs.back() );
       if( rc != 0 ) {
-         fprintf(stderr, "Failed to open '%s': %d %s\n", syndicate_path, rc, strerror( abs(rc) ) );
+         fprintf(stderr, "Failed to read '%s': %s\n", seg.local_path, strerror(-rc));
          rc = 1;
          goto write_end;
       }
+   }
+
+   // merge them into runs of contiguous pieces
+   write_pieces( segs, pieces );
+
+   // open syndicate file
+   fh = UG_open( ug, syndicate_path, O_WRONLY, &rc );
+   if( rc != 0 ) {
+      fprintf(stderr, "Failed to open '%s': %d %s\n", syndicate_path, rc, strerror( abs(rc) ) );
+      rc = 1;
+      goto write_end;
+   }
+
+   ugf.ug = ug;
+   ugf.fh = fh;
+
+   for( size_t i = 0; i < pieces.size(); i = end ) {
+
+      run_len = pieces[i].len;
+      for( end = i + 1; end < pieces.size() && pieces[end].offset == pieces[end-1].offset + pieces[end-1].len; end++ ) {
+         run_len += pieces[end].len;
+      }
 
       // seek... 
-      rc = UG_seek( fh, offset, SEEK_SET );
+      rc = UG_seek( fh, pieces[i].offset, SEEK_SET );
       if( rc < 0 ) {
-         fprintf(stderr, "Failed to seek to %" PRId64 ": %s\n", offset, strerror(abs(rc)));
+         fprintf(stderr, "Failed to seek to %jd: %s\n", (intmax_t)pieces[i].offset, strerror(abs(rc)));
          rc = 1;
          goto write_end;
       } 
 
-      // write the file
-      while( 1 ) {
-         nr = read( fd, buf, 4096 );
-         if( nr == 0 ) {
-            break;
-         }
-         if( nr < 0 ) {
-            rc = -errno;
-            fprintf(stderr, "Failed to read '%s': %s\n", local_path, strerror( abs(rc) ) );
-            break;
-         }
+      // write the run, reading the next buffer while the current one is written.
+      // The first write stops at the next I/O unit boundary, so the rest are aligned.
+      memset( &run, 0, sizeof(struct write_run) );
+      run.segs = &segs[0];
+      run.pieces = &pieces[i];
+      run.num_pieces = end - i;
+      run.head_len = (io_size - (pieces[i].offset % io_size)) % io_size;
 
-         SG_debug("Write %zd bytes\n", nr);
-         rc = UG_write( ug, buf, nr, fh );
-         if( rc < 0 ) {
+      if( opts.mmap && end - i == 1 && segs[ pieces[i].seg ].data == NULL && pieces[i].offset == segs[ pieces[i].seg ].offset && pieces[i].len == segs[ pieces[i].seg ].len ) {
 
-            fprintf(stderr, "Failed to write '%s': %d %s\n", local_path, rc, strerror( abs(rc) ) );
-            break;
+         // a whole regular file, with nothing written over it
+         run.failed = &segs[ pieces[i].seg ];
+         rc = pipeline_mmap_run( run.failed->fd, run.failed->len, run.head_len, buf_len, pipeline_drain_ug, &ugf, &stats );
+      }
+      else {
+
+         // buffers are only needed if some run can't be mapped
+         if( pl == NULL ) {
+            pl = pipeline_new( buf_len, PIPELINE_DEPTH );
+            if( pl == NULL ) {
+               SG_error("%s", "Out of memory\n");
+               rc = 1;
+               goto write_end;
+            }
          }
+
+         rc = pipeline_run( pl, write_fill_run, &run, pipeline_drain_ug, &ugf, &stats );
+      }
+      if( stats.fill_rc < 0 ) {
+         fprintf(stderr, "Failed to read '%s': %s\n", run.failed->local_path, strerror( abs(stats.fill_rc) ) );
+      }
+      if( stats.drain_rc < 0 ) {
+         fprintf(stderr, "Failed to write %jd bytes at %jd: %d %s\n", (intmax_t)run_len, (intmax_t)pieces[i].offset, stats.drain_rc, strerror( abs(stats.drain_rc) ) );
       }
 
-      close( fd );
+      SG_debug("Wrote %" PRIu64 " bytes at %jd\n", stats.bytes, (intmax_t)pieces[i].offset );
 
       if( rc < 0 ) {
          rc = 1;
@@ -152,22 +420,37 @@ int main( int argc, char** argv ) {
    rc = UG_fsync( ug, fh );
    if( rc < 0 ) {
          
-      fprintf(stderr, "Failed to fsync '%s': %d %s\n", local_path, rc, strerror( abs(rc) ) );
+      fprintf(stderr, "Failed to fsync '%s': %d %s\n", syndicate_path, rc, strerror( abs(rc) ) );
       rc = 1;
       goto write_end;
    }
 
    // close 
    rc = UG_close( ug, fh );
+   fh = NULL;
    if( rc != 0 ) {
-      fprintf(stderr, "Failed to close '%s': %d %s\n", local_path, rc, strerror( abs(rc) ) );
+      fprintf(stderr, "Failed to close '%s': %d %s\n", syndicate_path, rc, strerror( abs(rc) ) );
       rc = 1;
       goto write_end;
    }
 
 write_end:
 
+   if( fh != NULL ) {
+      UG_close( ug, fh );
+   }
+
    UG_shutdown( ug );
+   pipeline_free( pl );
+
+   for( size_t i = 0; i < segs.size(); i++ ) {
+
+      if( segs[i].fd >= 0 ) {
+         close( segs[i].fd );
+      }
+
+      SG_safe_free( segs[i].data );
+   }
 
    if( rc != 0 ) {
       exit(1);
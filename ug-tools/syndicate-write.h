@@ -39,6 +39,15 @@
  * @section description DESCRIPTION
  * Copy a FILE starting at the OFFSET (in bytes) from the syndicate VOLUME_NAME to LOCALFILE.
  *
+ * All LOCALFILE OFFSET pairs are read before anything is written.  They are applied in offset order, and adjacent or overlapping ones are merged and written together, in large writes.  Where two of them overlap, the one given later wins.
+ *
+ * @section options OPTIONS
+ * --mmap\n
+ * Map regular local files into memory and write them to the volume straight from the mapping, instead of reading them into buffers first.  This is only done for files that are not merged with other LOCALFILEs; pipes and other special files are still read into buffers.
+ *
+ * --io-size SIZE\n
+ * Write to Syndicate in whole multiples of SIZE bytes, at offsets that are multiples of SIZE (K, M and G suffixes are allowed).  If OFFSET is not a multiple of SIZE, the first write only goes up to the next multiple.  The default is the volume's block size.
+ *
  * @copydetails md_common_usage()
  *
  * @section example EXAMPLES
@@ -68,6 +77,11 @@
 #include <libsyndicate-ug/client.h>
 #include <libsyndicate-ug/core.h>
 
+#include <algorithm>
+#include <set>
+#include <vector>
+
 #include "common.h"
+#include "pipeline.h"
 
 #endif